@@ -0,0 +1,352 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+#include <sys/mman.h>
+#include "pbbslib/alloc.h"
+#include "numa.h"
+
+// *******************************************
+//   NODE ALLOCATORS
+//   Allocation policies for tree nodes, passed as the Allocator
+//   template argument of pam_map, pam_set, aug_map, etc.
+//   Each policy is a template over the node type with the same static
+//   interface as pbbs::type_allocator: init, reserve, finish, alloc,
+//   free, num_used_blocks, num_allocated_blocks, block_size and
+//   initialized.
+// *******************************************
+
+namespace pam_alloc {
+
+  // per thread counters that are summed on demand, so that counting
+  // allocations does not share a cache line between threads.
+  // Counters of exited threads keep their counts and are handed to
+  // the next new thread.
+  struct counters {
+    struct alignas(64) counter { std::atomic<long> n{0}; };
+    std::mutex lock;
+    std::vector<counter*> all;
+    std::vector<counter*> spare;
+
+    ~counters() { for (counter* c : all) delete c; }
+
+    counter* add() {
+      std::lock_guard<std::mutex> g(lock);
+      if (spare.size() > 0) {
+	counter* c = spare.back();
+	spare.pop_back();
+	return c;
+      }
+      all.push_back(new counter);
+      return all.back();
+    }
+
+    void give_back(counter* c) {
+      std::lock_guard<std::mutex> g(lock);
+      spare.push_back(c);
+    }
+
+    long sum() {
+      std::lock_guard<std::mutex> g(lock);
+      long s = 0;
+      for (counter* c : all) s += c->n.load(std::memory_order_relaxed);
+      return s;
+    }
+
+    void reset() {
+      std::lock_guard<std::mutex> g(lock);
+      for (counter* c : all) c->n.store(0);
+    }
+  };
+
+  // chunks from the ordinary heap
+  struct heap_chunks {
+    static constexpr size_t chunk_bytes = 1 << 20;
+    static void* get() { return ::operator new(chunk_bytes); }
+    static void release(void* p) { ::operator delete(p); }
+  };
+
+  // 2MB aligned chunks advised to be backed by transparent huge pages.
+  // Pages are not touched, so they can still be placed.
+  struct huge_chunks {
+    static constexpr size_t chunk_bytes = 1 << 21;
+    static void* get() {
+      size_t len = 2 * chunk_bytes;
+      char* p = (char*) mmap(NULL, len, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == (char*) MAP_FAILED) throw std::bad_alloc();
+      // trim to an aligned chunk
+      char* a = (char*) (((size_t) p + chunk_bytes - 1) & ~(chunk_bytes - 1));
+      if (a > p) munmap(p, a - p);
+      char* e = a + chunk_bytes;
+      if (p + len > e) munmap(e, p + len - e);
+#ifdef MADV_HUGEPAGE
+      madvise(a, chunk_bytes, MADV_HUGEPAGE);
+#endif
+      return a;
+    }
+    static void release(void* p) { munmap(p, chunk_bytes); }
+  };
+
+  // huge page chunks on the NUMA node of the allocating thread
+  struct numa_local_chunks : huge_chunks {
+    static void* get() {
+      void* a = huge_chunks::get();
+      numa::place_local(a, chunk_bytes);
+      return a;
+    }
+  };
+
+  // huge page chunks interleaved across all NUMA nodes
+  struct numa_interleaved_chunks : huge_chunks {
+    static void* get() {
+      void* a = huge_chunks::get();
+      numa::place_interleaved(a, chunk_bytes);
+      return a;
+    }
+  };
+
+  // Nodes are bump allocated from per-thread chunks.  If Reuse, freed
+  // nodes go to a per-thread free list and are handed out again,
+  // otherwise free only updates the count and memory is returned all at
+  // once by finish() (an arena).  finish() must only be called when no
+  // nodes are live.
+  // A thread that frees much more than it allocates (e.g. a reclaim
+  // worker) would strand its free list, so free lists that reach
+  // return_batch blocks go to a shared list of batches, as do the free
+  // lists of exited threads.  A thread whose free list is empty takes
+  // a batch from there before bumping.  The unused ends of exited
+  // threads' chunks are bumped from by the next thread that needs one.
+  template <class T, class Chunks, bool Reuse>
+  struct block_pool {
+    // free lists are per thread and full ones are shared, so any
+    // thread can free (see reclaim.h)
+    static constexpr bool frees_anywhere = true;
+
+    static constexpr size_t round_up(size_t n, size_t a) {
+      return (n + a - 1) / a * a;}
+    // blocks also hold the free list link
+    static constexpr size_t block_bytes =
+      round_up(sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*),
+	       alignof(T));
+    static constexpr size_t blocks_per_chunk = Chunks::chunk_bytes / block_bytes;
+    static constexpr size_t return_batch = 1024;
+
+    struct batch {
+      void* list;
+      size_t n;
+    };
+
+    struct local {
+      char* next = nullptr;
+      char* end = nullptr;
+      void* free_list = nullptr;
+      size_t free_n = 0;
+      size_t generation = 0;
+      counters::counter* used = nullptr;
+      // a thread's free list outlives it on the shared list
+      ~local() {
+	if (used) block_pool::used.give_back(used);
+	if (generation != block_pool::generation.load()) return;
+	if (free_list) give_back(free_list, free_n);
+	if (next != end) {
+	  std::lock_guard<std::mutex> g(chunk_lock);
+	  partial.push_back(batch{next, (size_t) (end - next)});
+	}
+      }
+    };
+
+    static inline bool initialized = false;
+    static inline std::atomic<size_t> generation{1};
+    static inline std::mutex chunk_lock;  // protects chunks and orphans
+    static inline std::vector<void*> chunks;
+    static inline std::vector<batch> orphans;
+    static inline std::vector<batch> partial;  // unused chunk ends, in bytes
+    static inline std::atomic<size_t> num_orphans{0};
+    static inline counters used;
+    static inline thread_local local my;
+
+    static void give_back(void* list, size_t n) {
+      std::lock_guard<std::mutex> g(chunk_lock);
+      orphans.push_back(batch{list, n});
+      num_orphans.store(orphans.size(), std::memory_order_relaxed);
+    }
+
+    // moves a batch from the shared list to l's empty free list
+    static bool adopt(local& l) {
+      if (num_orphans.load(std::memory_order_relaxed) == 0) return false;
+      std::lock_guard<std::mutex> g(chunk_lock);
+      if (orphans.empty()) return false;
+      l.free_list = orphans.back().list;
+      l.free_n = orphans.back().n;
+      orphans.pop_back();
+      num_orphans.store(orphans.size(), std::memory_order_relaxed);
+      return true;
+    }
+
+    static void init() { initialized = true; }
+    static void reserve(size_t n, bool randomize = false) { init(); }
+
+    static void finish() {
+      std::lock_guard<std::mutex> g(chunk_lock);
+      for (void* c : chunks) Chunks::release(c);
+      chunks.clear();
+      orphans.clear();
+      num_orphans = 0;
+      partial.clear();
+      used.reset();
+      generation++;  // invalidates every thread's bump pointer and free list
+    }
+
+    static local& get_local() {
+      local& l = my;
+      if (l.generation != generation.load(std::memory_order_relaxed)) {
+	l.next = l.end = nullptr;
+	l.free_list = nullptr;
+	l.free_n = 0;
+	l.generation = generation.load();
+      }
+      if (!l.used) l.used = used.add();
+      return l;
+    }
+
+    static T* alloc() {
+      local& l = get_local();
+      l.used->n.fetch_add(1, std::memory_order_relaxed);
+      return take(l);
+    }
+
+    static void free(T* p) {
+      local& l = get_local();
+      l.used->n.fetch_sub(1, std::memory_order_relaxed);
+      recycle(l, p);
+    }
+
+    // as alloc and free, but without counting, for pools that keep
+    // their own count
+    static T* take() { return take(get_local()); }
+    static void recycle(T* p) { recycle(get_local(), p); }
+
+    static T* take(local& l) {
+      if (Reuse && (l.free_list || adopt(l))) {
+	void* r = l.free_list;
+	l.free_list = *((void**) r);
+	l.free_n--;
+	return (T*) r;
+      }
+      if (l.next == l.end) {
+	std::unique_lock<std::mutex> g(chunk_lock);
+	if (partial.size() > 0) {
+	  l.next = (char*) partial.back().list;
+	  l.end = l.next + partial.back().n;
+	  partial.pop_back();
+	} else {
+	  g.unlock();
+	  char* c = (char*) Chunks::get();
+	  g.lock();
+	  chunks.push_back(c);
+	  l.next = c;
+	  l.end = c + blocks_per_chunk * block_bytes;
+	}
+      }
+      T* r = (T*) l.next;
+      l.next += block_bytes;
+      return r;
+    }
+
+    static void recycle(local& l, T* p) {
+      if (Reuse) {
+	*((void**) p) = l.free_list;
+	l.free_list = (void*) p;
+	if (++l.free_n == return_batch) {
+	  give_back(l.free_list, l.free_n);
+	  l.free_list = nullptr;
+	  l.free_n = 0;
+	}
+      }
+    }
+
+    static size_t num_used_blocks() { return used.sum(); }
+
+    static size_t num_allocated_blocks() {
+      std::lock_guard<std::mutex> g(chunk_lock);
+      return chunks.size() * blocks_per_chunk;
+    }
+
+    static size_t block_size() { return block_bytes; }
+  };
+
+  // Nodes go on the NUMA node of the thread that creates them, or are
+  // interleaved across nodes inside a numa::interleave_guard (used for
+  // the top levels of a tree, which every worker reads).
+  // Freed nodes are reused by the freeing thread whichever pool they
+  // came from, so the two pools are not counted separately: used
+  // counts the nodes of both.
+  template <class T>
+  struct numa_pool {
+    using local_pool = block_pool<T, numa_local_chunks, true>;
+    using interleaved_pool = block_pool<T, numa_interleaved_chunks, true>;
+
+    static constexpr bool frees_anywhere = true;
+    static inline bool initialized = false;
+    static inline counters used;
+
+    struct local {
+      counters::counter* c = nullptr;
+      ~local() { if (c) used.give_back(c); }
+    };
+    static inline thread_local local my;
+
+    static counters::counter& count() {
+      if (!my.c) my.c = used.add();
+      return *my.c;
+    }
+
+    static void init() {
+      local_pool::init(); interleaved_pool::init();
+      initialized = true;
+    }
+    static void reserve(size_t n, bool randomize = false) { init(); }
+
+    static void finish() {
+      local_pool::finish(); interleaved_pool::finish();
+      used.reset();
+    }
+
+    static T* alloc() {
+      count().n.fetch_add(1, std::memory_order_relaxed);
+      if (numa::interleaving()) return interleaved_pool::take();
+      else return local_pool::take();
+    }
+
+    static void free(T* p) {
+      count().n.fetch_sub(1, std::memory_order_relaxed);
+      local_pool::recycle(p);
+    }
+
+    static size_t num_used_blocks() { return used.sum(); }
+
+    static size_t num_allocated_blocks() {
+      return (local_pool::num_allocated_blocks() +
+	      interleaved_pool::num_allocated_blocks());}
+
+    static size_t block_size() { return local_pool::block_size(); }
+  };
+}
+
+// the default pool
+template <class T>
+using pool_allocator = pbbs::type_allocator<T>;
+
+// per-thread bump arena, memory is only returned by finish()
+template <class T>
+using arena_allocator = pam_alloc::block_pool<T, pam_alloc::heap_chunks, false>;
+
+// pool of transparent huge pages with per-thread free lists
+template <class T>
+using hugepage_allocator = pam_alloc::block_pool<T, pam_alloc::huge_chunks, true>;
+
+// nodes are placed on the NUMA node of the thread creating them
+template <class T>
+using numa_allocator = pam_alloc::numa_pool<T>;
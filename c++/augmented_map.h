@@ -21,6 +21,20 @@ public:
   using GC = typename Map::GC;
   using maybe_V = maybe<V>;
   using maybe_E = maybe<E>;
+  using KI = std::pair<K,size_t>;
+
+  // (key, position) pairs for key_of(i), i < n, sorted by key
+  template <class F>
+  static pbbs::sequence<KI> sorted_indexed(size_t n, const F& key_of) {
+    pbbs::sequence<KI> B(n, [&] (size_t i) {return KI(key_of(i), i);});
+    bool sorted = true;
+    for (size_t i = 1; i < n && sorted; i++)
+      sorted = !Entry::comp(B[i].first, B[i-1].first);
+    if (sorted) return B;
+    auto less = [&] (const KI& a, const KI& b) {
+      return Entry::comp(a.first, b.first);};
+    return pbbs::sample_sort(B, less);
+  }
 
   template<class F>
   static M aug_filter(M m, const F& f) {
@@ -40,9 +54,69 @@ public:
     return a.result;}
   
   A aug_range(const K& key_left, const K& key_right) {
-    typename Tree::aug_sum_t a;
-    Tree::aug_sum_range(Map::root, key_left, key_right, a);
-    return a.result;}
+    return Tree::aug_range(Map::root, key_left, key_right);}
+
+  // Batched aug_left, out[i] = aug_left(SS[i]).  The batch is answered
+  // in one shared traversal.  Unsorted keys are sorted first.
+  template<class Seq>
+  static void aug_left_batch(const M& m, Seq const &SS, A* out) {
+    size_t n = SS.size();
+    bool sorted = true;
+    for (size_t i = 1; i < n && sorted; i++)
+      sorted = !Entry::comp(SS[i], SS[i-1]);
+    if (sorted) Tree::aug_left_sorted(m.root, SS.begin(), n, out);
+    else {
+      pbbs::sequence<KI> B = sorted_indexed(n, [&] (size_t i) {return SS[i];});
+      Tree::aug_prefix_indexed(m.root, B.begin(), n, false, out);
+    }
+  }
+
+  template<class Seq>
+  static pbbs::sequence<A> aug_left_batch(const M& m, Seq const &SS) {
+    pbbs::sequence<A> out(SS.size());
+    aug_left_batch(m, SS, out.begin());
+    return out;
+  }
+
+  // Batched aug_range over (key_left, key_right) pairs,
+  // out[i] = aug_range(R[i].first, R[i].second).  If the augmentation
+  // is invertible both ends are answered as shared batched prefix sums,
+  // otherwise the ranges share one divide-and-conquer pass that splits
+  // them where they separate (see augmented_ops::aug_range_sorted).
+  template<class Seq>
+  static void aug_range_batch(const M& m, Seq const &R, A* out) {
+    size_t n = R.size();
+    if constexpr (Tree::invertible) {
+      pbbs::sequence<A> lt(n);
+      pbbs::sequence<KI> L = sorted_indexed(n, [&] (size_t i) {return R[i].first;});
+      pbbs::sequence<KI> H = sorted_indexed(n, [&] (size_t i) {return R[i].second;});
+      Tree::aug_prefix_indexed(m.root, L.begin(), n, true, lt.begin());
+      Tree::aug_prefix_indexed(m.root, H.begin(), n, false, out);
+      parallel_for(0, n, [&] (size_t i) {
+	if (Entry::comp(R[i].second, R[i].first)) out[i] = Entry::get_empty();
+	else out[i] = Entry::combine(Entry::inverse(lt[i]), out[i]);});
+    } else {
+      using RQ = typename Tree::range_query;
+      pbbs::sequence<RQ> Q(n, [&] (size_t i) {
+	  return RQ{R[i].first, R[i].second, i};});
+      auto empty = [&] (size_t i) {
+	return Entry::comp(R[i].second, R[i].first);};
+      parallel_for(0, n, [&] (size_t i) {
+	if (empty(i)) out[i] = Entry::get_empty();});
+      Q = pbbs::pack(Q, pbbs::delayed_seq<bool>(n, [&] (size_t i) {
+	    return !empty(i);}));
+      Q = pbbs::sample_sort(Q, [&] (const RQ& x, const RQ& y) {
+	  return Entry::comp(x.l, y.l);});
+      Tree::aug_range_sorted(m.root, Q.begin(), Q.size(), out);
+    }
+  }
+
+  template<class Seq>
+  static pbbs::sequence<A> aug_range_batch(const M& m, Seq const &R) {
+    pbbs::sequence<A> out(R.size());
+    aug_range_batch(m, R, out.begin());
+    return out;
+  }
 
   // just side effecting
   template <class restricted_sum>
@@ -60,6 +134,9 @@ public:
     auto replace = [] (const V& a, const V& b) {return b;};
     return M(Tree::insert_lazy(m.get_root(), p, replace)); }
 
+  static transient_map<M> to_transient(M m) {
+    return transient_map<M>(std::move(m)); }
+
   // for coercing a map to an aug_map
   aug_map_(Map&& m) {if (this != &m) {this->root = m.root; m.root = NULL;} }
   aug_map_() : Map() { }
@@ -87,13 +164,39 @@ public:
     return Map::insert(std::move(m),p);}
   static M remove(M m, const K& k) {return Map::remove(std::move(m), k);}
   template<class F>
-  static M filter(M m, const F& f) {return Map::filter(std::move(m), f);}
+  static M filter(M m, const F& f, size_t granularity = utils::node_limit) {
+    return Map::filter(std::move(m), f, granularity);}
   static M multi_insert(M m, pbbs::sequence<E> SS, bool seq_inplace = false) {
     return Map::multi_insert(std::move(m), SS, seq_inplace);}
   template<class Bin_Op>
   static M multi_insert_combine(M m, pbbs::sequence<E> S, Bin_Op f, 
 				bool seq_inplace = false) {
     return Map::multi_insert_combine(std::move(m), S, f, seq_inplace);}
+  template<class Seq>
+  static M append_sorted(M m, Seq const &SS) {
+    return Map::append_sorted(std::move(m), SS);}
+  template<class Seq, class Bin_Op>
+  static M append_sorted(M m, Seq const &SS, const Bin_Op& f) {
+    return Map::append_sorted(std::move(m), SS, f);}
+  template<class Seq>
+  static M multi_delete(M m, Seq const &SS) {
+    return Map::multi_delete(std::move(m), SS);}
+  using tagged_op = typename Map::tagged_op;
+  using Map::batch_insert;
+  using Map::batch_update;
+  using Map::batch_delete;
+  template<class Seq, class Bin_Op>
+  static M multi_apply(M m, Seq const &SS, Bin_Op f) {
+    return Map::multi_apply(std::move(m), SS, f);}
+  template<class Seq>
+  static M multi_apply(M m, Seq const &SS) {
+    return Map::multi_apply(std::move(m), SS);}
+  template<class Seq>
+  static void multi_find(const M& m, Seq const &SS, maybe_V* out) {
+    Map::multi_find(m, SS, out);}
+  template<class Seq>
+  static void multi_find_sorted(const M& m, Seq const &SS, maybe_V* out) {
+    Map::multi_find_sorted(m, SS, out);}
   template<class Val, class Reduce>
   static M multi_insert_reduce(M m, pbbs::sequence<pair<K,Val>> S, Reduce g) {
     return Map::multi_insert_reduce(std::move(m), S, g); }
@@ -104,12 +207,26 @@ public:
   template<class F>
   static M map_union(M a, M b, const F& op) {return Map::map_union(std::move(a), std::move(b), op);}
   static M map_union(M a, M b) {return Map::map_union(std::move(a), std::move(b));}
+  template<class Seq, class F>
+  static M map_union_k(Seq ms, const F& op) {
+    return Map::map_union_k(std::move(ms), op);}
+  template<class Seq>
+  static M map_union_k(Seq ms) {return Map::map_union_k(std::move(ms));}
+  template<class Seq, class F>
+  static M map_intersect_k(Seq ms, const F& op) {
+    return Map::map_intersect_k(std::move(ms), op);}
+  template<class Seq>
+  static M map_intersect_k(Seq ms) {return Map::map_intersect_k(std::move(ms));}
   static M map_difference(M a, M b) {return Map::map_difference(std::move(a), std::move(b));}
   static M join2(M a, M b) {return Map::join2(std::move(a), std::move(b));}
-  static M range(M& a, K kl, K kr) {return Map::range(a,kl,kr);}
-  static M upTo(M& a, K kr) {return Map::upTo(a,kr);}
+  static M interleave_top(M m, size_t levels = 10) {
+    return Map::interleave_top(std::move(m), levels);}
+  static M range(M& a, const K& kl, const K& kr) {return Map::range(a,kl,kr);}
+  static M upTo(M& a, const K& kr) {return Map::upTo(a,kr);}
   template<class Ma, class F>
   static M map(Ma a, const F f) {return Map::map(a, f);}
+  template<class F>
+  static M map(M a, const F& f) {return M(Tree::map_inplace(a.get_root(), f));}
   static void entries(M m, E* out) { Map::entries(std::move(m),out);}
   template <class outItter>
   static void keys(M m, outItter out) {Map::keys(std::move(m),out);}
@@ -125,6 +242,15 @@ public:
   static typename R::T map_reduce(const M& m, const F& f, const R& r,
 				  size_t grain=utils::node_limit) {
     return Map::template map_reduce<R>(m, f, r, grain);}
+  template<class R, class F>
+  static typename R::T map_reduce_range(const M& m, const K& kl, const K& kr,
+					const F& f, const R& r,
+					size_t grain=utils::node_limit) {
+    return Map::template map_reduce_range<R>(m, kl, kr, f, r, grain);}
+  template<class F>
+  static void foreach_range(const M& m, const K& kl, const K& kr, const F& f,
+			    size_t granularity = utils::node_limit) {
+    Map::foreach_range(m, kl, kr, f, granularity); }
   template<class F>
   static void map_index(M m, const F& f, size_t granularity = utils::node_limit,
 			size_t start=0) {
@@ -132,9 +258,22 @@ public:
   template<class Ma, class F>
   static M map_filter(Ma a, const F& f) {return Map::map_filter(a,f);}
   template<class F>
-  static bool if_exist(M m, const F& f) {return Map::if_exist(m,f);}
+  static bool if_exist(const M& m, const F& f) {return Map::if_exist(m,f);}
+  template<class F>
+  static bool any_of(const M& m, const F& f) {return Map::any_of(m,f);}
+  template<class F>
+  static maybe_E find_if(const M& m, const F& f) {return Map::find_if(m,f);}
+  template<class F>
+  static maybe_E first_match(const M& m, const F& f) {
+    return Map::first_match(m,f);}
   template<class Ma, class F>
   static M map_set(Ma a, const F& f) {return Map::map_set(a, f);}
+  template<class F>
+  static M map_set(M a, const F& f) {
+    return M(Tree::map_set_inplace(a.get_root(), f));}
+  template<class F>
+  static M map_filter(M a, const F& f) {
+    return M(Tree::map_filter_inplace(a.get_root(), f));}
   template <class F>
   static void foreach_index(M m, F f, size_t start=0,
 			    size_t granularity = utils::node_limit) {
@@ -151,6 +290,11 @@ public:
   using Map::contains;
   using Map::next;
   using Map::previous;
+  using typename Map::iterator;
+  using Map::begin;
+  using Map::end;
+  using Map::seek;
+  using Map::range_view;
   using Map::rank;
   using Map::select;
   using Map::root;
@@ -165,19 +309,42 @@ struct aug_map_full_entry : entry {
   using key_t = typename entry::key_t;
   using aug_t = typename entry::aug_t;
   using entry_t = std::pair<key_t,val_t>;
-  static inline key_t get_key(const entry_t& e) {return e.first;}
-  static inline val_t get_val(const entry_t& e) {return e.second;}
+  static inline const key_t& get_key(const entry_t& e) {return e.first;}
+  static inline const val_t& get_val(const entry_t& e) {return e.second;}
   static inline void set_val(entry_t& e, const val_t& v) {e.second = v;}
   static inline aug_t from_entry(const entry_t& e) {
     return entry::from_entry(e.first, e.second);}
 };
 
-template <class _Entry, class Balance=weight_balanced_tree>
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
 using aug_map =
   aug_map_<aug_map_full_entry<_Entry>,
   typename Balance::template
   balance<aug_node<typename Balance::data,
-		   aug_map_full_entry<_Entry>>>>;
+		   aug_map_full_entry<_Entry>, Allocator>>>;
+
+// as aug_map, but augmented values are only computed when a query
+// reads them (see lazy_augmented_node.h)
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
+using lazy_aug_map =
+  aug_map_<aug_map_full_entry<_Entry>,
+  typename Balance::template
+  balance<lazy_aug_node<typename Balance::data,
+			aug_map_full_entry<_Entry>, Allocator>>>;
+
+// as aug_map, but only subtrees of at least threshold entries store
+// their augmented value (see sparse_augmented_node.h)
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator,
+	  size_t threshold=32>
+using sparse_aug_map =
+  aug_map_<aug_map_full_entry<_Entry>,
+  typename Balance::template
+  balance<sparse_aug_node<typename Balance::data,
+			  aug_map_full_entry<_Entry>, Allocator,
+			  threshold>>>;
 
 // creates a key-value pair for the entry, and redefines from_entry
 template <class entry>
@@ -186,7 +353,7 @@ struct aug_set_full_entry : entry {
   using key_t = typename entry::key_t;
   using aug_t = typename entry::aug_t;
   using entry_t = key_t;
-  static inline key_t get_key(const entry_t& e) {return e;}
+  static inline const key_t& get_key(const entry_t& e) {return e;}
   static inline val_t get_val(const entry_t& e) {return 0;}
   static inline void set_val(entry_t& e, const val_t& v) {}
 };
@@ -197,9 +364,10 @@ struct aug_set_full_entry : entry {
 //    from_entry(key_t) -> aug_t,
 //    get_empty() -> aug_tm,
 //    combine(aug_t, aug_t) -> aug_t
-template <class _Entry, class Balance=weight_balanced_tree>
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
 using aug_set =
   aug_map_<aug_set_full_entry<_Entry>,
   typename Balance::template
   balance<aug_node<typename Balance::data,
-		   aug_set_full_entry<_Entry>>>>;
+		   aug_set_full_entry<_Entry>, Allocator>>>;
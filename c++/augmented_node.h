@@ -13,28 +13,52 @@
 //   get_empty() -> aug_t;
 //   from_entry(entry_t) -> aug_t;
 //   combine(aut_t, aug_t) -> aug_t;
-template<class balance, class Entry>
+// and optionally
+//   combine_inplace(aug_t& a, const aug_t& b)  -- sets a to combine(a, b)
+// which is used instead of combine when present.  It avoids building
+// temporaries when aug_t is expensive to copy (e.g. a nested map).
+template<class balance, class Entry,
+	 template<class> class Allocator = pool_allocator>
 struct aug_node : basic_node<balance, std::pair<typename Entry::entry_t,
-						typename Entry::aug_t>> {
+						typename Entry::aug_t>,
+			     Allocator> {
   using AT = typename Entry::aug_t;
   using ET = typename Entry::entry_t;
-  using basic = basic_node<balance, std::pair<ET,AT>>;
+  using basic = basic_node<balance, std::pair<ET,AT>, Allocator>;
   using node = typename basic::node;
 
   static ET& get_entry(node *a) {return a->entry.first;}
   static ET* get_entry_p(node *a) {return &a->entry.first;}
-  static void set_entry(node *a, ET e) {a->entry.first = e;}
+  template <class T>
+  static void set_entry(node *a, T&& e) {a->entry.first = std::forward<T>(e);}
 
   static AT aug_val(node* a) {
     if (a == NULL) return Entry::get_empty();
     else return (a->entry).second;}
+
+  // a is not null
+  static const AT& aug_ref(node* a) {return (a->entry).second;}
+
+  template <class E, class = void>
+  struct has_combine_inplace : std::false_type {};
+  template <class E>
+  struct has_combine_inplace<E, std::void_t<decltype(
+      E::combine_inplace(std::declval<AT&>(), std::declval<const AT&>()))>>
+    : std::true_type {};
+
+  // a = combine(a, b)
+  static void combine_into(AT& a, const AT& b) {
+    if constexpr (has_combine_inplace<Entry>::value)
+      Entry::combine_inplace(a, b);
+    else a = Entry::combine(std::move(a), b);
+  }
   
   static void update(node* a) {
     basic::update(a);
-    AT av = Entry::from_entry(get_entry(a));
-    if (a->lc) av = Entry::combine(((a->lc)->entry).second, av);
-    if (a->rc) av = Entry::combine(av, ((a->rc)->entry).second);
-    (a->entry).second = av;
+    AT av = a->lc ? ((a->lc)->entry).second : Entry::from_entry(get_entry(a));
+    if (a->lc) combine_into(av, Entry::from_entry(get_entry(a)));
+    if (a->rc) combine_into(av, ((a->rc)->entry).second);
+    (a->entry).second = std::move(av);
   }
 
   // updates augmented value using f, instead of recomputing
@@ -44,14 +68,15 @@ struct aug_node : basic_node<balance, std::pair<typename Entry::entry_t,
     (a->entry).second = f((a->entry).second);    
   }
 
-  static node* make_node(ET e) {
-    std::pair<ET,AT> ea;
-    ea.first = e;
-    return basic::make_node(ea);
+  // the augmented value is set by the next update
+  template <class T>
+  static node* make_node(T&& e) {
+    return basic::make_node(std::pair<ET,AT>(std::forward<T>(e), AT()));
   }
 
-  static node* single(ET e) {
+  template <class T>
+  static node* single(T&& e) {
     AT av = Entry::from_entry(e);
-    return basic::single(std::make_pair(e,av));
+    return basic::single(std::pair<ET,AT>(std::forward<T>(e), std::move(av)));
   }
 };
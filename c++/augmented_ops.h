@@ -1,6 +1,7 @@
 #pragma once
 #include "utils.h"
 #include "map_ops.h"
+#include "pbbslib/sample_sort.h"
 
 // *******************************************
 //   AUGMENTED MAP OPERATIONS
@@ -15,19 +16,16 @@ struct augmented_ops : Map {
   using K = typename Map::K;
   using aug_t = typename Entry::aug_t;
   
-  static inline aug_t aug_val(node* b) {
-	  if (!b) return Entry::get_empty();
-	  return b->entry.second;
-  }
+  static inline aug_t aug_val(node* b) { return Map::aug_val(b); }
 
   struct aug_sum_t {
     aug_t result;
     aug_sum_t() : result(Entry::get_empty()) {}
-    void add_entry(ET e) {
-      result = Entry::combine(result, Entry::from_entry(e));
+    void add_entry(const ET& e) {
+      Map::combine_into(result, Entry::from_entry(e));
     }
-    void add_aug_val(aug_t av) {
-      result = Entry::combine(result, av);
+    void add_aug_val(const aug_t& av) {
+      Map::combine_into(result, av);
     }
   };
 
@@ -37,8 +35,7 @@ struct augmented_ops : Map {
     while (b) {
       if (!Map::comp(Map::get_key(b), key)) {
 	a.add_entry(Map::get_entry(b));
-	//if (b->rc) a.add_aug_val(aug_val(b->rc));
-	if (b->rc) a.add_aug_val(b->rc->entry.second);
+	if (b->rc) a.add_aug_val(Map::aug_ref(b->rc));
 	b = b->lc;
       } else b = b->rc;
     }
@@ -50,13 +47,50 @@ struct augmented_ops : Map {
     while (b) {
       if (!Map::comp(key, Map::get_key(b))) {
 	a.add_entry(Map::get_entry(b));
-	//if (b->lc) a.add_aug_val(aug_val(b->lc));
-	if (b->lc) a.add_aug_val(b->lc->entry.second);
+	if (b->lc) a.add_aug_val(Map::aug_ref(b->lc));
+	b = b->rc;
+      } else b = b->lc;
+    }
+  }
+
+  template<class aug>
+  // the sum strictly left of key
+  static void aug_sum_less(node* b, const K& key, aug& a) {
+    while (b) {
+      if (Map::comp(Map::get_key(b), key)) {
+	if (b->lc) a.add_aug_val(Map::aug_ref(b->lc));
+	a.add_entry(Map::get_entry(b));
 	b = b->rc;
       } else b = b->lc;
     }
   }
 
+  // An Entry may define inverse(aug_t) -> aug_t when its augmentation
+  // forms a group (e.g. sums or counts).  Ranges are then answered as
+  // differences of prefix sums.
+  template <class E, class = void>
+  struct has_inverse : std::false_type {};
+  template <class E>
+  struct has_inverse<E, std::void_t<decltype(
+      E::inverse(std::declval<const aug_t&>()))>> : std::true_type {};
+
+  static constexpr bool invertible = has_inverse<Entry>::value;
+
+  // the sum of entries with keys in [key_left, key_right]
+  static aug_t aug_range(node* b, const K& key_left, const K& key_right) {
+    aug_sum_t a;
+    if constexpr (invertible) {
+      if (Map::comp(key_right, key_left)) return a.result;
+      aug_sum_t lt;
+      aug_sum_less(b, key_left, lt);
+      aug_sum_left(b, key_right, a);
+      return Entry::combine(Entry::inverse(lt.result), a.result);
+    } else {
+      aug_sum_range(b, key_left, key_right, a);
+      return a.result;
+    }
+  }
+
   template<class aug>
   static void aug_sum_range(node* b, const K& key_left, const K& key_right, aug& a) {
     node* r = Map::range_root(b, key_left, key_right);
@@ -69,6 +103,144 @@ struct augmented_ops : Map {
     }
   }
 
+  // Batched prefix sums over A[0,n), sorted by key with get_k(A[i]).
+  // Calls out(offset+i, s) exactly once for each i, where s is acc
+  // combined with the sum of the entries with keys <= get_k(A[i])
+  // (< if strict).  The queries share one walk over the tree, so m
+  // queries take O(m log(n/m + 1)) work.
+  template <class T, class GetKey, class Out>
+  static void aug_prefix_f(node* b, T* A, size_t n, size_t offset,
+			   const aug_t& acc, bool strict,
+			   const GetKey& get_k, const Out& out) {
+    if (n == 0) return;
+    if (!b) {
+      for (size_t i = 0; i < n; i++) out(offset+i, acc);
+      return;
+    }
+    const K& bk = Map::get_key(b);
+    // queries whose prefix does not include b go left
+    auto goes_left = [&] (const T& a) -> bool {
+      return strict ? !Map::comp(bk, get_k(a)) : Map::comp(get_k(a), bk);};
+    size_t mid = pbbs::binary_search(pbbs::sequence<T>(A, n), goes_left);
+    aug_t racc = acc;
+    if (mid < n) {
+      if (b->lc) Map::combine_into(racc, Map::aug_ref(b->lc));
+      Map::combine_into(racc, Entry::from_entry(Map::get_entry(b)));
+    }
+    utils::fork_no_result(utils::do_parallel(Map::size(b), n),
+      [&] () {aug_prefix_f(b->lc, A, mid, offset, acc, strict, get_k, out);},
+      [&] () {aug_prefix_f(b->rc, A+mid, n-mid, offset+mid, racc,
+			   strict, get_k, out);});
+  }
+
+  // keys in A are sorted, out[i] gets the sum of entries with keys <= A[i]
+  static void aug_left_sorted(node* b, K* A, size_t n, aug_t* out) {
+    auto get_k = [] (const K& a) -> const K& {return a;};
+    auto f = [&] (size_t i, const aug_t& s) {out[i] = s;};
+    aug_prefix_f(b, A, n, 0, Entry::get_empty(), false, get_k, f);
+  }
+
+  // A holds (key, query index) pairs sorted by key, out[A[i].second]
+  // gets the sum of entries with keys <= A[i].first (< if strict)
+  static void aug_prefix_indexed(node* b, std::pair<K,size_t>* A, size_t n,
+				 bool strict, aug_t* out) {
+    auto get_k = [] (const std::pair<K,size_t>& a) -> const K& {
+      return a.first;};
+    auto f = [&] (size_t i, const aug_t& s) {out[A[i].second] = s;};
+    aug_prefix_f(b, A, n, 0, Entry::get_empty(), strict, get_k, f);
+  }
+
+  // The mirror of aug_prefix_f: calls out(offset+i, s) where s is the
+  // sum of the entries with keys >= get_k(A[i]), combined with acc (the
+  // sum of everything to the right of b).
+  template <class T, class GetKey, class Out>
+  static void aug_suffix_f(node* b, T* A, size_t n, size_t offset,
+			   const aug_t& acc, const GetKey& get_k,
+			   const Out& out) {
+    if (n == 0) return;
+    if (!b) {
+      for (size_t i = 0; i < n; i++) out(offset+i, acc);
+      return;
+    }
+    const K& bk = Map::get_key(b);
+    // queries whose suffix includes b go left
+    auto goes_left = [&] (const T& a) -> bool {
+      return !Map::comp(bk, get_k(a));};
+    size_t mid = pbbs::binary_search(pbbs::sequence<T>(A, n), goes_left);
+    aug_t lacc = acc;
+    if (mid > 0) {
+      lacc = Entry::from_entry(Map::get_entry(b));
+      if (b->rc) Map::combine_into(lacc, Map::aug_ref(b->rc));
+      Map::combine_into(lacc, acc);
+    }
+    utils::fork_no_result(utils::do_parallel(Map::size(b), n),
+      [&] () {aug_suffix_f(b->lc, A, mid, offset, lacc, get_k, out);},
+      [&] () {aug_suffix_f(b->rc, A+mid, n-mid, offset+mid, acc,
+			   get_k, out);});
+  }
+
+  struct range_query { K l; K r; size_t i; };
+
+  // Batched aug_range without inverses.  Q holds non-empty ranges
+  // (l <= r) sorted by l, and out[Q[j].i] gets the sum over [l, r].
+  // A query goes down to the highest node with a key in its range,
+  // where its sum is the suffix of the left subtree from l, the node's
+  // entry, and the prefix of the right subtree up to r.  The queries
+  // that stop at a node answer both sides with one shared walk each.
+  // Q is reordered in place.  S is scratch space as large as Q.
+  static void aug_range_sorted(node* b, range_query* Q, size_t n,
+			       aug_t* out, range_query* S) {
+    if (n == 0) return;
+    if (!b) {
+      for (size_t j = 0; j < n; j++) out[Q[j].i] = Entry::get_empty();
+      return;
+    }
+    const K& bk = Map::get_key(b);
+    // queries starting after bk go right
+    size_t mid = pbbs::binary_search(pbbs::sequence<range_query>(Q, n),
+      [&] (const range_query& q) {return !Map::comp(bk, q.l);});
+    // of the rest, those ending before bk go left, and the others stop
+    // here.  A stable partition keeps the left ones sorted by l.
+    size_t nl = 0, h = 0;
+    for (size_t j = 0; j < mid; j++) {
+      if (Map::comp(Q[j].r, bk)) Q[nl++] = std::move(Q[j]);
+      else S[h++] = std::move(Q[j]);
+    }
+    range_query* H = Q + nl;
+    std::move(S, S + h, H);
+
+    auto here = [&] () {
+      if (h == 0) return;
+      pbbs::sequence<aug_t> left(h);
+      auto get_l = [] (const range_query& q) -> const K& {return q.l;};
+      aug_suffix_f(b->lc, H, h, 0, Entry::get_empty(), get_l,
+		   [&] (size_t j, const aug_t& a) {
+		     left[j] = a;
+		     Map::combine_into(left[j], Entry::from_entry(Map::get_entry(b)));});
+      using KI = std::pair<K,size_t>;
+      pbbs::sequence<KI> R(h, [&] (size_t j) {return KI(H[j].r, j);});
+      R = pbbs::sample_sort(R, [&] (const KI& x, const KI& y) {
+	  return Map::comp(x.first, y.first);});
+      auto get_r = [] (const KI& x) -> const K& {return x.first;};
+      aug_prefix_f(b->rc, R.begin(), h, 0, Entry::get_empty(), false, get_r,
+		   [&] (size_t k, const aug_t& a) {
+		     size_t j = R[k].second;
+		     out[H[j].i] = Entry::combine(left[j], a);});
+    };
+    utils::fork_no_result(utils::do_parallel(Map::size(b), n),
+      [&] () {
+	utils::fork_no_result(utils::do_parallel(Map::size(b), nl),
+	  [&] () {aug_range_sorted(b->lc, Q, nl, out, S);},
+	  here);},
+      [&] () {aug_range_sorted(b->rc, Q+mid, n-mid, out, S+mid);});
+  }
+
+  static void aug_range_sorted(node* b, range_query* Q, size_t n,
+			       aug_t* out) {
+    pbbs::sequence<range_query> S(n);
+    aug_range_sorted(b, Q, n, out, S.begin());
+  }
+
   template<typename Func>
   static node* aug_select(node* b, const Func& f) {
     if (b == NULL) return NULL;
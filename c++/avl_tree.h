@@ -36,8 +36,9 @@ struct avl_tree {
       t->height = std::max(height(t->lc),height(t->rc)) + 1;
     }
 
-    static node* single(ET e) {
-      node *o = Node::single(e);
+    template <class T>
+    static node* single(T&& e) {
+      node *o = Node::single(std::forward<T>(e));
       o->height = 1;
       return o;
     }
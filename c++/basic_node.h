@@ -1,6 +1,6 @@
 #pragma once
-//#include "pbbslib/list_allocator.h"
 #include "pbbslib/alloc.h"
+#include "allocators.h"
 
 using node_size_t = unsigned int;
 //using node_size_t = size_t;
@@ -9,7 +9,9 @@ using node_size_t = unsigned int;
 //   BASIC NODE
 // *******************************************
 
-template<class balance, class _ET>
+// Allocator is a node allocation policy (see allocators.h)
+template<class balance, class _ET,
+	 template<class> class Allocator = pool_allocator>
 struct basic_node {
   using ET = _ET;
 
@@ -20,8 +22,7 @@ struct basic_node {
     node_size_t ref_cnt;
   };
   
-  using allocator = pbbs::type_allocator<node>;
-  //using allocator = list_allocator<node>;
+  using allocator = Allocator<node>;
 
   static node_size_t size(node* a) {
     return (a == NULL) ? 0 : a->s;
@@ -31,16 +32,18 @@ struct basic_node {
     a->s = size(a->lc) + size(a->rc) + 1;
   }
 
-  static node* make_node(ET e) {
+  // the entry is constructed in place from e (copied or moved)
+  template <class T>
+  static node* make_node(T&& e) {
     node *o = allocator::alloc();
     o->ref_cnt = 1;
-    //o->entry = e;
-    pbbs::assign_uninitialized(o->entry,e);
+    new (&o->entry) ET(std::forward<T>(e));
     return o;
   }
 
-  static node* single(ET e) {
-    node* r = make_node(e);
+  template <class T>
+  static node* single(T&& e) {
+    node* r = make_node(std::forward<T>(e));
     r->lc = r->rc = NULL; r->s = 1;
     return r;
   }
@@ -53,7 +56,8 @@ struct basic_node {
   static node* empty() {return NULL;}
   inline static ET& get_entry(node *a) {return a->entry;}
   inline static ET* get_entry_p(node *a) {return &(a->entry);}
-  static void set_entry(node *a, ET e) {a->entry = e;}
+  template <class T>
+  static void set_entry(node *a, T&& e) {a->entry = std::forward<T>(e);}
   static node* left(node a) {return a.lc;}
   static node* right(node* a) {return a.rc;}
 };
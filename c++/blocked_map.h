@@ -0,0 +1,218 @@
+#pragma once
+
+using namespace std;
+
+// *******************************************
+//   BLOCKED MAPS
+//   Maps and sets whose small subtrees are stored as flat blocks
+//   (see blocked_ops.h).  B is the minimum block size, blocks
+//   hold up to 2*B entries.
+// *******************************************
+
+template <class _Entry, size_t B, class Encoder,
+	  template<class> class Allocator = pool_allocator>
+class blocked_map_ {
+public:
+  using Entry = _Entry;
+  using Tree = blocked_ops<Entry, B, Encoder, Allocator>;
+  using node = typename Tree::node;
+  using E = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+  using M = blocked_map_;
+  using Build = build<Entry>;
+  using maybe_V = maybe<V>;
+  using maybe_E = maybe<E>;
+  using allocator = typename Tree::allocator;
+
+  // initializing, reserving and finishing
+  static void init() { allocator::init(); }
+  static void reserve(size_t n, bool randomize=false) {
+    allocator::reserve(n, randomize);}
+  static void finish() { allocator::finish(); }
+  static size_t num_used_nodes() { return allocator::num_used_blocks(); }
+  static size_t num_used_leaves() { return Tree::num_leaves; }
+
+  blocked_map_() : root(NULL) { init(); }
+
+  // copy constructor, increment reference count
+  blocked_map_(const M& m) {
+    root = m.root; Tree::increment(root);}
+
+  // move constructor, clear the source, leave reference count as is
+  blocked_map_(M&& m) {
+    root = m.root; m.root = NULL;}
+
+  M& operator = (const M& m) {
+    if (this != &m) { clear(); root = m.root; Tree::increment(root); }
+    return *this;
+  }
+
+  M& operator = (M&& m) {
+    if (this != &m) { clear(); root = m.root; m.root = NULL;}
+    return *this;
+  }
+
+  ~blocked_map_() { clear(); }
+
+  // singleton
+  blocked_map_(const E& e) { init(); root = Tree::make_leaf(&e, 1);}
+
+  // construct from an array keeping one of the equal keys
+  blocked_map_(E* s, E* e) {
+    init();
+    pbbs::sequence<E> A = Build::sort_remove_duplicates(pbbs::range<E*>(s,e));
+    root = Tree::from_array(A.begin(), A.size()); }
+
+  // construct from sequence keeping one of the equal keys
+  blocked_map_(pbbs::sequence<E> const &S) {
+    init();
+    pbbs::sequence<E> A = Build::sort_remove_duplicates(S);
+    root = Tree::from_array(A.begin(), A.size()); }
+
+  // clears contents, decrementing ref counts
+  void clear() {
+    node* t = root;
+    if (__sync_bool_compare_and_swap(&(this->root), t, NULL))
+      Tree::decrement_recursive(t);
+  }
+
+  size_t size() const { return Tree::size(root); }
+  bool is_empty() {return root == NULL;}
+
+  maybe_V find(const K& key) const {
+    maybe_E e = Tree::find(root, key);
+    if (e) return maybe_V(Entry::get_val(*e));
+    return maybe_V();
+  }
+
+  bool contains(const K& key) const {
+    return (bool) Tree::find(root, key);}
+
+  template<class Seq>
+  static M from_sorted(Seq const &S) {
+    return M(Tree::from_array(S.begin(), S.size()));
+  }
+
+  template <class Func>
+  static M insert(M m, const E& p, const Func& f) {
+    return M(Tree::multi_insert_sorted(m.get_root(), &p, 1, f)); }
+
+  static M insert(M m, const E& p) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    return M(Tree::multi_insert_sorted(m.get_root(), &p, 1, replace)); }
+
+  void insert(const E& p) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    root = Tree::multi_insert_sorted(root, &p, 1, replace); }
+
+  static M remove(M m, const K& k) {
+    typename Tree::split_info s = Tree::split(m.get_root(), k);
+    return M(Tree::join2(s.first, s.second));
+  }
+
+  // insert multiple entries from a sequence
+  template<class Seq>
+  static M multi_insert(M m, Seq const &SS) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    pbbs::sequence<E> A = Build::sort_remove_duplicates(SS);
+    return M(Tree::multi_insert_sorted(m.get_root(), A.begin(),
+				       A.size(), replace));
+  }
+
+  template<class Seq>
+  static M multi_insert_sorted(M m, Seq const &SS) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    return M(Tree::multi_insert_sorted(m.get_root(), SS.begin(),
+				       SS.size(), replace));
+  }
+
+  template<class F>
+  static M map_union(M a, M b, const F& op) {
+    return M(Tree::uniont(a.get_root(), b.get_root(), op));
+  }
+
+  static M map_union(M a, M b) {
+    auto get_right = [] (V a, V b) {return b;};
+    return M(Tree::uniont(a.get_root(), b.get_root(), get_right));
+  }
+
+  template<class F>
+  static M map_intersect(M a, M b, const F& op) {
+    return M(Tree::intersect(a.get_root(), b.get_root(), op));
+  }
+
+  static M map_intersect(M a, M b) {
+    auto get_right = [] (V a, V b) {return b;};
+    return M(Tree::intersect(a.get_root(), b.get_root(), get_right));
+  }
+
+  static M map_difference(M a, M b) {
+    return M(Tree::difference(a.get_root(), b.get_root()));
+  }
+
+  template<class F>
+  static M filter(M m, const F& f, size_t granularity=utils::node_limit) {
+    return M(Tree::filter(m.get_root(), f, granularity)); }
+
+  template<class R, class F>
+  static typename R::T map_reduce(const M& m, const F& f, const R& r,
+				  size_t grain=utils::node_limit) {
+    return Tree::template map_reduce<R>(m.root, f, r, grain);
+  }
+
+  template <class F>
+  static void foreach_index(const M& m, const F& f, size_t start=0,
+			    size_t granularity = utils::node_limit) {
+    Tree::foreach_index(m.root, start, f, granularity);
+  }
+
+  template <class F>
+  static void foreach_seq(const M& m, const F& f) {
+    Tree::foreach_seq(m.root, f);
+  }
+
+  // flatten all entries to a sequence
+  static pbbs::sequence<E> entries(const M& m,
+				   size_t granularity=utils::node_limit) {
+    pbbs::sequence<E> out = pbbs::sequence<E>::no_init(m.size());
+    auto f = [&] (E& e, size_t i) {pbbs::assign_uninitialized(out[i], e);};
+    Tree::foreach_index(m.root, 0, f, granularity);
+    return out;
+  }
+
+  // flatten all keys to an array
+  template <class outItter>
+  static void keys(const M& m, outItter out) {
+    auto f = [&] (E& e, size_t i) {out[i] = Entry::get_key(e);};
+    Tree::foreach_index(m.root, 0, f);
+  }
+
+  bool operator == (const M& m) const {
+    return (size() == m.size()) && (size() == map_union(*this,m).size());
+  }
+
+  bool operator != (const M& m) const { return !(*this == m); }
+
+  // grabs root by "moving" it.  Important for reuse
+  node* get_root() {node* t = root; root = NULL; return t;};
+
+  node* root;
+
+  // construct from a node (perhaps should be private)
+  blocked_map_(node* n) : root(n) { init(); }
+};
+
+template <class _Entry, size_t B = 32,
+	  template <class> class Encoder = plain_block_encoder,
+	  template<class> class Allocator = pool_allocator>
+using pam_blocked_map =
+  blocked_map_<map_full_entry<_Entry>, B,
+	       Encoder<map_full_entry<_Entry>>, Allocator>;
+
+template <class _Entry, size_t B = 32,
+	  template <class> class Encoder = plain_block_encoder,
+	  template<class> class Allocator = pool_allocator>
+using pam_blocked_set =
+  blocked_map_<set_full_entry<_Entry>, B,
+	       Encoder<set_full_entry<_Entry>>, Allocator>;
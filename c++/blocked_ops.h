@@ -0,0 +1,773 @@
+#pragma once
+#include <cstring>
+#include <type_traits>
+#include "utils.h"
+#include "basic_node.h"
+
+// *******************************************
+//   BLOCKED TREES
+//   Subtrees with at most 2*B entries are stored as a single leaf
+//   block that holds the entries in sorted order, so most entries
+//   carry no node header at all.  The block is written and read
+//   through an Encoder, which must supply:
+//     encoded_size(const ET*, n) -> size_t  (bytes)
+//     encode(const ET*, n, uint8_t*)
+//     decode(uint8_t*, n, f)   calls f(ET&) on the entries in order
+//     find(uint8_t*, n, key) -> maybe<ET>
+//     destroy(uint8_t*, n)
+//   Internal nodes are weight balanced.  All rebalancing goes
+//   through expose and join, so a block is only cut up when a
+//   rotation needs to look inside it.
+//   All operations consume their tree arguments, as in map_ops,
+//   except for find, map_reduce and the foreach functions.
+// *******************************************
+
+// stores a block as a plain array of entries
+template <class Entry>
+struct plain_block_encoder {
+  using ET = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+
+  static size_t encoded_size(const ET* A, size_t n) {
+    return n * sizeof(ET);}
+
+  static void encode(const ET* A, size_t n, uint8_t* b) {
+    ET* o = (ET*) b;
+    for (size_t i = 0; i < n; i++) pbbs::assign_uninitialized(o[i], A[i]);
+  }
+
+  template <class F>
+  static void decode(uint8_t* b, size_t n, const F& f) {
+    ET* a = (ET*) b;
+    for (size_t i = 0; i < n; i++) f(a[i]);
+  }
+
+  static maybe<ET> find(uint8_t* b, size_t n, const K& k) {
+    ET* a = (ET*) b;
+    size_t l = 0, r = n;
+    while (l < r) {
+      size_t mid = (l + r)/2;
+      if (Entry::comp(Entry::get_key(a[mid]), k)) l = mid + 1;
+      else r = mid;
+    }
+    if (l < n && !Entry::comp(k, Entry::get_key(a[l]))) return maybe<ET>(a[l]);
+    return maybe<ET>();
+  }
+
+  static void destroy(uint8_t* b, size_t n) {
+    ET* a = (ET*) b;
+    for (size_t i = 0; i < n; i++) a[i].~ET();
+  }
+};
+
+// Shared part of the integer encoders below.  Values, if the entry has
+// any, are stored uncoded at the front of the block and the coded keys
+// follow them.  Requires an integer key type.
+template <class Entry>
+struct int_block_encoder {
+  using ET = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+  using UK = typename std::make_unsigned<K>::type;
+  static constexpr bool has_val = !std::is_same<ET, K>::value;
+  static_assert(std::is_integral<K>::value,
+		"block key encoding requires an integer key type");
+
+  static size_t val_bytes(size_t n) { return has_val ? n * sizeof(V) : 0; }
+
+  static void encode_vals(const ET* A, size_t n, uint8_t* b) {
+    if constexpr (has_val) {
+      V* vals = (V*) b;
+      for (size_t i = 0; i < n; i++)
+	pbbs::assign_uninitialized(vals[i], Entry::get_val(A[i]));
+    }
+  }
+
+  static ET make_entry(K k, uint8_t* b, size_t i) {
+    if constexpr (has_val) return ET(k, ((V*) b)[i]);
+    else return k;
+  }
+
+  static void destroy(uint8_t* b, size_t n) {
+    if constexpr (has_val) {
+      V* vals = (V*) b;
+      for (size_t i = 0; i < n; i++) vals[i].~V();
+    }
+  }
+};
+
+// Stores the keys of a block as the first key followed by byte coded
+// differences, 7 bits per byte with the high bit marking continuation.
+template <class Entry>
+struct diff_block_encoder : int_block_encoder<Entry> {
+  using base = int_block_encoder<Entry>;
+  using ET = typename base::ET;
+  using K = typename base::K;
+  using UK = typename base::UK;
+
+  static size_t code_size(UK d) {
+    size_t s = 1;
+    while (d >= 128) {d >>= 7; s++;}
+    return s;
+  }
+
+  static size_t encoded_size(const ET* A, size_t n) {
+    size_t bytes = base::val_bytes(n) + sizeof(K);
+    for (size_t i = 1; i < n; i++)
+      bytes += code_size((UK) Entry::get_key(A[i]) - (UK) Entry::get_key(A[i-1]));
+    return bytes;
+  }
+
+  static void encode(const ET* A, size_t n, uint8_t* b) {
+    base::encode_vals(A, n, b);
+    uint8_t* p = b + base::val_bytes(n);
+    K first = Entry::get_key(A[0]);
+    memcpy(p, &first, sizeof(K));
+    p += sizeof(K);
+    for (size_t i = 1; i < n; i++) {
+      UK d = (UK) Entry::get_key(A[i]) - (UK) Entry::get_key(A[i-1]);
+      while (d >= 128) {*p++ = (uint8_t) (d & 127) | 128; d >>= 7;}
+      *p++ = (uint8_t) d;
+    }
+  }
+
+  // calls f(key, i) on the keys in order while f returns true
+  template <class F>
+  static void decode_keys(uint8_t* b, size_t n, const F& f) {
+    uint8_t* p = b + base::val_bytes(n);
+    K k;
+    memcpy(&k, p, sizeof(K));
+    p += sizeof(K);
+    if (!f(k, 0)) return;
+    for (size_t i = 1; i < n; i++) {
+      UK d = 0;
+      int shift = 0;
+      uint8_t c;
+      do {c = *p++; d |= (UK) (c & 127) << shift; shift += 7;} while (c & 128);
+      k = (K) ((UK) k + d);
+      if (!f(k, i)) return;
+    }
+  }
+
+  template <class F>
+  static void decode(uint8_t* b, size_t n, const F& f) {
+    decode_keys(b, n, [&] (K k, size_t i) {
+	ET e = base::make_entry(k, b, i);
+	f(e);
+	return true;});
+  }
+
+  static maybe<ET> find(uint8_t* b, size_t n, const K& key) {
+    size_t at = n;
+    decode_keys(b, n, [&] (K k, size_t i) {
+	if (Entry::comp(k, key)) return true;
+	if (!Entry::comp(key, k)) at = i;
+	return false;});
+    if (at == n) return maybe<ET>();
+    return maybe<ET>(base::make_entry(key, b, at));
+  }
+};
+
+// Stores the keys of a block as the first key followed by differences
+// packed into w bits each, where w fits the largest difference.
+template <class Entry>
+struct packed_block_encoder : int_block_encoder<Entry> {
+  using base = int_block_encoder<Entry>;
+  using ET = typename base::ET;
+  using K = typename base::K;
+  using UK = typename base::UK;
+
+  static size_t width(const ET* A, size_t n) {
+    UK m = 0;
+    for (size_t i = 1; i < n; i++)
+      m = std::max(m, (UK) ((UK) Entry::get_key(A[i]) - (UK) Entry::get_key(A[i-1])));
+    size_t w = 0;
+    while (m > 0) {m >>= 1; w++;}
+    return w;
+  }
+
+  static size_t encoded_size(const ET* A, size_t n) {
+    return base::val_bytes(n) + sizeof(K) + 1 + ((n-1) * width(A, n) + 7)/8;
+  }
+
+  static void encode(const ET* A, size_t n, uint8_t* b) {
+    base::encode_vals(A, n, b);
+    uint8_t* p = b + base::val_bytes(n);
+    K first = Entry::get_key(A[0]);
+    memcpy(p, &first, sizeof(K));
+    p += sizeof(K);
+    size_t w = width(A, n);
+    *p++ = (uint8_t) w;
+    memset(p, 0, ((n-1) * w + 7)/8);
+    size_t pos = 0;
+    for (size_t i = 1; i < n; i++) {
+      UK d = (UK) Entry::get_key(A[i]) - (UK) Entry::get_key(A[i-1]);
+      for (size_t left = w; left > 0; ) {
+	size_t off = pos & 7;
+	size_t take = std::min(8 - off, left);
+	p[pos >> 3] |= (uint8_t) ((d & ((1u << take) - 1)) << off);
+	d = (take < 8 * sizeof(UK)) ? (UK) (d >> take) : 0;
+	pos += take; left -= take;
+      }
+    }
+  }
+
+  // calls f(key, i) on the keys in order while f returns true
+  template <class F>
+  static void decode_keys(uint8_t* b, size_t n, const F& f) {
+    uint8_t* p = b + base::val_bytes(n);
+    K k;
+    memcpy(&k, p, sizeof(K));
+    p += sizeof(K);
+    size_t w = *p++;
+    if (!f(k, 0)) return;
+    size_t pos = 0;
+    for (size_t i = 1; i < n; i++) {
+      UK d = 0;
+      for (size_t got = 0; got < w; ) {
+	size_t off = pos & 7;
+	size_t take = std::min(8 - off, w - got);
+	d |= (UK) ((p[pos >> 3] >> off) & ((1u << take) - 1)) << got;
+	pos += take; got += take;
+      }
+      k = (K) ((UK) k + d);
+      if (!f(k, i)) return;
+    }
+  }
+
+  template <class F>
+  static void decode(uint8_t* b, size_t n, const F& f) {
+    decode_keys(b, n, [&] (K k, size_t i) {
+	ET e = base::make_entry(k, b, i);
+	f(e);
+	return true;});
+  }
+
+  static maybe<ET> find(uint8_t* b, size_t n, const K& key) {
+    size_t at = n;
+    decode_keys(b, n, [&] (K k, size_t i) {
+	if (Entry::comp(k, key)) return true;
+	if (!Entry::comp(key, k)) at = i;
+	return false;});
+    if (at == n) return maybe<ET>();
+    return maybe<ET>(base::make_entry(key, b, at));
+  }
+};
+
+// Allocator is the allocation policy of the internal nodes (see
+// allocators.h).  Leaves vary in size and come from pbbs::my_alloc.
+template <class EntryT, size_t B, class Encoder,
+	  template<class> class Allocator = pool_allocator>
+struct blocked_ops {
+  using Entry = EntryT;
+  using ET = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+
+  static constexpr size_t block_limit = 2 * B;
+
+  struct node {
+    node_size_t s;
+    node_size_t ref_cnt;
+    bool is_leaf;
+  };
+
+  struct regular_node : node {
+    node* lc; node* rc;
+    ET entry;
+  };
+
+  // the encoded block is stored directly after the header
+  struct alignas(16) leaf_node : node { };
+  static_assert(alignof(ET) <= 16, "entry alignment too large for a block");
+
+  using allocator = Allocator<regular_node>;
+
+  static inline size_t num_leaves = 0;
+
+  // uninitialized local storage for up to cap entries
+  template <size_t cap>
+  struct buffer {
+    alignas(ET) unsigned char data[cap * sizeof(ET)];
+    size_t n = 0;
+    ET* begin() { return (ET*) data; }
+    ET& operator[] (size_t i) { return begin()[i]; }
+    void push(const ET& e) { pbbs::assign_uninitialized(begin()[n++], e); }
+    ~buffer() { for (size_t i = 0; i < n; i++) begin()[i].~ET(); }
+  };
+
+  static size_t size(node* a) { return (a == NULL) ? 0 : a->s; }
+  static regular_node* reg(node* a) { return (regular_node*) a; }
+  static uint8_t* block(node* a) { return (uint8_t*) (((leaf_node*) a) + 1); }
+  static K get_key(const ET& e) { return Entry::get_key(e); }
+  static bool comp(const K& a, const K& b) { return Entry::comp(a, b); }
+
+  // index of the first entry in A not less than k
+  static size_t lower(const ET* A, size_t n, const K& k) {
+    size_t l = 0, r = n;
+    while (l < r) {
+      size_t mid = (l + r)/2;
+      if (comp(get_key(A[mid]), k)) l = mid + 1;
+      else r = mid;
+    }
+    return l;
+  }
+
+  template <class Buf>
+  static void decode(node* a, Buf& buf) {
+    Encoder::decode(block(a), a->s, [&] (ET& e) {buf.push(e);});
+  }
+
+  // ****** allocation and reference counting ******
+
+  static node* make_leaf(const ET* A, size_t n) {
+    if (n == 0) return NULL;
+    size_t bytes = Encoder::encoded_size(A, n);
+    leaf_node* l = (leaf_node*) pbbs::my_alloc(sizeof(leaf_node) + bytes);
+    l->s = n; l->ref_cnt = 1; l->is_leaf = true;
+    Encoder::encode(A, n, block(l));
+    pbbs::write_add(&num_leaves, 1);
+    return l;
+  }
+
+  static node* make_regular(node* l, const ET& e, node* r) {
+    regular_node* o = allocator::alloc();
+    o->s = size(l) + size(r) + 1;
+    o->ref_cnt = 1; o->is_leaf = false;
+    o->lc = l; o->rc = r;
+    pbbs::assign_uninitialized(o->entry, e);
+    return o;
+  }
+
+  static void free_regular(regular_node* a) {
+    (a->entry).~ET();
+    allocator::free(a);
+  }
+
+  static void increment(node* t) {
+    if (t) pbbs::write_add(&t->ref_cnt, 1);
+  }
+
+  // atomically decrement ref count and if zero free the node
+  // and recursively decrement its children
+  static void decrement_recursive(node* t) {
+    if (!t) return;
+    if (pbbs::fetch_and_add(&t->ref_cnt, -1) != 1) return;
+    if (t->is_leaf) {
+      Encoder::destroy(block(t), t->s);
+      pbbs::my_free(t);
+      pbbs::write_add(&num_leaves, -1);
+      return;
+    }
+    node* lsub = reg(t)->lc;
+    node* rsub = reg(t)->rc;
+    free_regular(reg(t));
+    utils::fork_no_result(size(lsub) >= utils::node_limit,
+      [&]() {decrement_recursive(lsub);},
+      [&]() {decrement_recursive(rsub);});
+  }
+
+  // writes all entries of a (small) tree into buf in order
+  template <class Buf>
+  static void flatten(node* t, Buf& buf) {
+    if (!t) return;
+    if (t->is_leaf) decode(t, buf);
+    else {
+      flatten(reg(t)->lc, buf);
+      buf.push(reg(t)->entry);
+      flatten(reg(t)->rc, buf);
+    }
+  }
+
+  // ****** expose and join ******
+
+  struct exposed {
+    node* l; node* r; ET e;
+  };
+
+  // Splits t into its left subtree, root entry and right subtree.
+  // A leaf is cut at its median.  Consumes t.
+  static exposed expose(node* t) {
+    exposed x;
+    if (t->is_leaf) {
+      size_t n = t->s, mid = n/2;
+      buffer<block_limit> buf;
+      Encoder::decode(block(t), n, [&] (ET& e) {
+	  if (buf.n == mid) x.e = e;
+	  buf.push(e);});
+      x.l = make_leaf(buf.begin(), mid);
+      x.r = make_leaf(buf.begin() + mid + 1, n - mid - 1);
+      decrement_recursive(t);
+    } else {
+      regular_node* a = reg(t);
+      x.l = a->lc; x.r = a->rc; x.e = a->entry;
+      if (a->ref_cnt == 1) free_regular(a);
+      else {
+	increment(x.l); increment(x.r);
+	decrement_recursive(t);
+      }
+    }
+    return x;
+  }
+
+  // makes a node with no rebalancing, or a leaf if small enough
+  static node* make(node* l, const ET& e, node* r) {
+    if (size(l) + size(r) + 1 > block_limit) return make_regular(l, e, r);
+    buffer<block_limit> buf;
+    flatten(l, buf); buf.push(e); flatten(r, buf);
+    decrement_recursive(l); decrement_recursive(r);
+    return make_leaf(buf.begin(), buf.n);
+  }
+
+  static constexpr double alpha = 0.29;
+  static constexpr double ratio = alpha / (1 - alpha);
+
+  static bool is_heavy(size_t n1, size_t n2) {
+    return ratio * (n1 + 1) > (n2 + 1);}
+
+  static bool is_like(size_t n1, size_t n2) {
+    return !is_heavy(n1, n2) && !is_heavy(n2, n1);}
+
+  static node* join_right(node* l, const ET& e, node* r) {
+    if (!is_heavy(size(l), size(r))) return make(l, e, r);
+    exposed x = expose(l);
+    node* t = join_right(x.r, e, r);
+    size_t nl = size(x.l);
+    if (is_like(nl, size(t))) return make(x.l, x.e, t);
+    exposed y = expose(t);
+    if (!y.l || (is_like(nl, size(y.l)) &&
+		 is_like(nl + size(y.l) + 1, size(y.r))))
+      return make(make(x.l, x.e, y.l), y.e, y.r);
+    exposed z = expose(y.l);
+    return make(make(x.l, x.e, z.l), z.e, make(z.r, y.e, y.r));
+  }
+
+  static node* join_left(node* l, const ET& e, node* r) {
+    if (!is_heavy(size(r), size(l))) return make(l, e, r);
+    exposed x = expose(r);
+    node* t = join_left(l, e, x.l);
+    size_t nr = size(x.r);
+    if (is_like(nr, size(t))) return make(t, x.e, x.r);
+    exposed y = expose(t);
+    if (!y.r || (is_like(nr, size(y.r)) &&
+		 is_like(nr + size(y.r) + 1, size(y.l))))
+      return make(y.l, y.e, make(y.r, x.e, x.r));
+    exposed z = expose(y.r);
+    return make(make(y.l, y.e, z.l), z.e, make(z.r, x.e, x.r));
+  }
+
+  static node* join(node* l, const ET& e, node* r) {
+    if (is_heavy(size(l), size(r))) return join_right(l, e, r);
+    if (is_heavy(size(r), size(l))) return join_left(l, e, r);
+    return make(l, e, r);
+  }
+
+  static std::pair<node*, ET> split_last(node* t) {
+    if (t->is_leaf) {
+      buffer<block_limit> buf;
+      decode(t, buf);
+      node* l = make_leaf(buf.begin(), buf.n - 1);
+      ET e = buf[buf.n - 1];
+      decrement_recursive(t);
+      return std::make_pair(l, e);
+    }
+    exposed x = expose(t);
+    if (!x.r) return std::make_pair(x.l, x.e);
+    std::pair<node*, ET> s = split_last(x.r);
+    return std::make_pair(join(x.l, x.e, s.first), s.second);
+  }
+
+  static node* join2(node* l, node* r) {
+    if (!l) return r;
+    if (!r) return l;
+    std::pair<node*, ET> s = split_last(l);
+    return join(s.first, s.second, r);
+  }
+
+  struct split_info {
+    split_info(node* first, node* second, bool removed)
+      : first(first), second(second), removed(removed) {};
+    node* first;  node* second; ET entry; bool removed;
+  };
+
+  static split_info split(node* t, const K& k) {
+    if (!t) return split_info(NULL, NULL, false);
+    if (t->is_leaf) {
+      buffer<block_limit> buf;
+      decode(t, buf);
+      size_t n = buf.n;
+      size_t i = lower(buf.begin(), n, k);
+      bool found = (i < n) && !comp(k, get_key(buf[i]));
+      if (!found && i == n) return split_info(t, NULL, false);
+      if (!found && i == 0) return split_info(NULL, t, false);
+      split_info r(make_leaf(buf.begin(), i),
+		   make_leaf(buf.begin() + i + found, n - i - found), found);
+      if (found) r.entry = buf[i];
+      decrement_recursive(t);
+      return r;
+    }
+    exposed x = expose(t);
+    K bk = get_key(x.e);
+    if (comp(bk, k)) {
+      split_info s = split(x.r, k);
+      s.first = join(x.l, x.e, s.first);
+      return s;
+    } else if (comp(k, bk)) {
+      split_info s = split(x.l, k);
+      s.second = join(s.second, x.e, x.r);
+      return s;
+    }
+    split_info s(x.l, x.r, true);
+    s.entry = x.e;
+    return s;
+  }
+
+  // Assumes A is sorted with no duplicates.  Does not consume A.
+  static node* from_array(const ET* A, size_t n) {
+    if (n == 0) return NULL;
+    if (n <= block_limit) return make_leaf(A, n);
+    size_t mid = n/2;
+    auto P = utils::fork<node*>(n >= utils::node_limit,
+      [&]() {return from_array(A, mid);},
+      [&]() {return from_array(A + mid + 1, n - mid - 1);});
+    return make_regular(P.first, A[mid], P.second);
+  }
+
+  // ****** searching and traversal (these do not consume) ******
+
+  static maybe<ET> find(node* t, const K& k) {
+    while (t && !t->is_leaf) {
+      regular_node* a = reg(t);
+      if (comp(k, get_key(a->entry))) t = a->lc;
+      else if (comp(get_key(a->entry), k)) t = a->rc;
+      else return maybe<ET>(a->entry);
+    }
+    if (!t) return maybe<ET>();
+    return Encoder::find(block(t), t->s, k);
+  }
+
+  template<class R, class F>
+  static typename R::T map_reduce(node* t, const F& f, const R& r,
+				  size_t grain=utils::node_limit) {
+    using T = typename R::T;
+    if (!t) return r.identity();
+    if (t->is_leaf) {
+      T v = r.identity();
+      Encoder::decode(block(t), t->s, [&] (ET& e) {v = r.add(v, f(e));});
+      return v;
+    }
+    regular_node* a = reg(t);
+    auto P = utils::fork<T>(t->s >= grain,
+      [&]() {return map_reduce<R>(a->lc, f, r, grain);},
+      [&]() {return map_reduce<R>(a->rc, f, r, grain);});
+    T v = f(a->entry);
+    return r.add(P.first, r.add(v, P.second));
+  }
+
+  template<typename F>
+  static void foreach_index(node* t, size_t start, const F& f,
+			    size_t granularity=utils::node_limit) {
+    if (!t) return;
+    if (t->is_leaf) {
+      size_t i = start;
+      Encoder::decode(block(t), t->s, [&] (ET& e) {f(e, i++);});
+      return;
+    }
+    regular_node* a = reg(t);
+    size_t lsize = size(a->lc);
+    f(a->entry, start + lsize);
+    utils::fork_no_result(t->s >= granularity,
+      [&] () {foreach_index(a->lc, start, f, granularity);},
+      [&] () {foreach_index(a->rc, start + lsize + 1, f, granularity);});
+  }
+
+  template<typename F>
+  static void foreach_seq(node* t, const F& f) {
+    if (!t) return;
+    if (t->is_leaf) Encoder::decode(block(t), t->s, f);
+    else {
+      foreach_seq(reg(t)->lc, f);
+      f(reg(t)->entry);
+      foreach_seq(reg(t)->rc, f);
+    }
+  }
+
+  // ****** bulk operations ******
+
+  // combines the values of two entries with equal keys into e,
+  // as op(a, b), or op(b, a) if flip is set
+  template <class BinaryOp>
+  static void combine_values(ET& e, const ET& a, const ET& b,
+			     const BinaryOp& op, bool flip) {
+    if (flip) Entry::set_val(e, op(Entry::get_val(b), Entry::get_val(a)));
+    else Entry::set_val(e, op(Entry::get_val(a), Entry::get_val(b)));
+  }
+
+  // Assumes A is sorted with no duplicates.  Values of keys already
+  // in t are combined as op(old, new), or op(new, old) if flip is set.
+  template <class BinaryOp>
+  static node* multi_insert_sorted(node* t, const ET* A, size_t n,
+				   const BinaryOp& op, bool flip = false) {
+    if (n == 0) return t;
+    if (!t) return from_array(A, n);
+    if (t->is_leaf) {
+      if (n > block_limit) return uniont(t, from_array(A, n), op, flip);
+      buffer<block_limit> buf;
+      decode(t, buf);
+      buffer<2*block_limit> out;
+      size_t i = 0, j = 0;
+      while (i < buf.n && j < n) {
+	if (comp(get_key(buf[i]), get_key(A[j]))) out.push(buf[i++]);
+	else if (comp(get_key(A[j]), get_key(buf[i]))) out.push(A[j++]);
+	else {
+	  out.push(A[j]);
+	  combine_values(out[out.n-1], buf[i++], A[j++], op, flip);
+	}
+      }
+      while (i < buf.n) out.push(buf[i++]);
+      while (j < n) out.push(A[j++]);
+      decrement_recursive(t);
+      return from_array(out.begin(), out.n);
+    }
+    size_t nt = t->s;
+    exposed x = expose(t);
+    K bk = get_key(x.e);
+    size_t mid = lower(A, n, bk);
+    bool dup = (mid < n) && !comp(bk, get_key(A[mid]));
+    auto P = utils::fork<node*>(utils::do_parallel(nt, n),
+      [&] () {return multi_insert_sorted(x.l, A, mid, op, flip);},
+      [&] () {return multi_insert_sorted(x.r, A + mid + dup,
+					 n - mid - dup, op, flip);});
+    if (dup) combine_values(x.e, x.e, A[mid], op, flip);
+    return join(P.first, x.e, P.second);
+  }
+
+  // Assumes A is sorted with no duplicates.  Removes their keys from t.
+  static node* multi_delete_sorted(node* t, const ET* A, size_t n) {
+    if (!t) return NULL;
+    if (n == 0) return t;
+    if (t->is_leaf) {
+      buffer<block_limit> out;
+      size_t j = 0;
+      Encoder::decode(block(t), t->s, [&] (ET& e) {
+	  while (j < n && comp(get_key(A[j]), get_key(e))) j++;
+	  if (j == n || comp(get_key(e), get_key(A[j]))) out.push(e);});
+      if (out.n == t->s) return t;
+      decrement_recursive(t);
+      return make_leaf(out.begin(), out.n);
+    }
+    size_t nt = t->s;
+    exposed x = expose(t);
+    K bk = get_key(x.e);
+    size_t mid = lower(A, n, bk);
+    bool dup = (mid < n) && !comp(bk, get_key(A[mid]));
+    auto P = utils::fork<node*>(utils::do_parallel(nt, n),
+      [&] () {return multi_delete_sorted(x.l, A, mid);},
+      [&] () {return multi_delete_sorted(x.r, A + mid + dup, n - mid - dup);});
+    if (dup) return join2(P.first, P.second);
+    return join(P.first, x.e, P.second);
+  }
+
+  // Values of equal keys are combined as op(a, b), or op(b, a) if flip
+  // is set.  A block on either side is merged into the other tree.
+  template <class BinaryOp>
+  static node* uniont(node* a, node* b, const BinaryOp& op, bool flip = false) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->is_leaf || b->is_leaf) {
+      if (!a->is_leaf) {std::swap(a, b); flip = !flip;}
+      buffer<block_limit> buf;
+      decode(a, buf);
+      decrement_recursive(a);
+      return multi_insert_sorted(b, buf.begin(), buf.n, op, !flip);
+    }
+    size_t na = a->s, nb = b->s;
+    exposed x = expose(b);
+    split_info s = split(a, get_key(x.e));
+    auto P = utils::fork<node*>(utils::do_parallel(na, nb),
+      [&] () {return uniont(s.first, x.l, op, flip);},
+      [&] () {return uniont(s.second, x.r, op, flip);});
+    if (s.removed) combine_values(x.e, s.entry, x.e, op, flip);
+    return join(P.first, x.e, P.second);
+  }
+
+  // A block on either side is answered by probing the other tree.
+  template <class BinaryOp>
+  static node* intersect(node* a, node* b, const BinaryOp& op, bool flip = false) {
+    if (!a || !b) {
+      decrement_recursive(a); decrement_recursive(b);
+      return NULL;
+    }
+    if (a->is_leaf || b->is_leaf) {
+      if (!a->is_leaf) {std::swap(a, b); flip = !flip;}
+      buffer<block_limit> out;
+      Encoder::decode(block(a), a->s, [&] (ET& e) {
+	  maybe<ET> m = find(b, get_key(e));
+	  if (m) {
+	    out.push(*m);
+	    combine_values(out[out.n-1], e, *m, op, flip);
+	  }});
+      decrement_recursive(a); decrement_recursive(b);
+      return from_array(out.begin(), out.n);
+    }
+    size_t na = a->s, nb = b->s;
+    exposed x = expose(b);
+    split_info s = split(a, get_key(x.e));
+    auto P = utils::fork<node*>(utils::do_parallel(na, nb),
+      [&] () {return intersect(s.first, x.l, op, flip);},
+      [&] () {return intersect(s.second, x.r, op, flip);});
+    if (s.removed) {
+      combine_values(x.e, s.entry, x.e, op, flip);
+      return join(P.first, x.e, P.second);
+    }
+    return join2(P.first, P.second);
+  }
+
+  static node* difference(node* a, node* b) {
+    if (!a) {decrement_recursive(b); return NULL;}
+    if (!b) return a;
+    if (a->is_leaf) {
+      buffer<block_limit> out;
+      Encoder::decode(block(a), a->s, [&] (ET& e) {
+	  if (!find(b, get_key(e))) out.push(e);});
+      decrement_recursive(b);
+      if (out.n == a->s) return a;
+      decrement_recursive(a);
+      return make_leaf(out.begin(), out.n);
+    }
+    if (b->is_leaf) {
+      buffer<block_limit> buf;
+      decode(b, buf);
+      decrement_recursive(b);
+      return multi_delete_sorted(a, buf.begin(), buf.n);
+    }
+    size_t na = a->s, nb = b->s;
+    exposed x = expose(a);
+    split_info s = split(b, get_key(x.e));
+    auto P = utils::fork<node*>(utils::do_parallel(na, nb),
+      [&] () {return difference(x.l, s.first);},
+      [&] () {return difference(x.r, s.second);});
+    if (s.removed) return join2(P.first, P.second);
+    return join(P.first, x.e, P.second);
+  }
+
+  template<class Func>
+  static node* filter(node* t, const Func& f,
+		      size_t granularity=utils::node_limit) {
+    if (!t) return NULL;
+    if (t->is_leaf) {
+      buffer<block_limit> out;
+      Encoder::decode(block(t), t->s, [&] (ET& e) {if (f(e)) out.push(e);});
+      if (out.n == t->s) return t;
+      decrement_recursive(t);
+      return make_leaf(out.begin(), out.n);
+    }
+    size_t n = t->s;
+    exposed x = expose(t);
+    auto P = utils::fork<node*>(n >= granularity,
+      [&]() {return filter(x.l, f, granularity);},
+      [&]() {return filter(x.r, f, granularity);});
+    if (f(x.e)) return join(P.first, x.e, P.second);
+    return join2(P.first, P.second);
+  }
+};
@@ -12,7 +12,7 @@ struct build {
   static pbbs::sequence<ET>
   sort_remove_duplicates(Seq const &A,
 			 bool seq_inplace = false, bool inplace = false) {
-    auto less = [&] (ET a, ET b) {
+    auto less = [&] (const ET& a, const ET& b) {
       return Entry::comp(Entry::get_key(a), Entry::get_key(b));};
     if (A.size() == 0) return pbbs::sequence<ET>(0);
     if (seq_inplace) {
@@ -45,7 +45,7 @@ struct build {
   
   pbbs::sequence<ET> 
   static sort_remove_duplicates(ET* A, size_t n) {
-    auto lessE = [&] (ET a, ET b) {
+    auto lessE = [&] (const ET& a, const ET& b) {
       return Entry::comp(a.first, b.first);};
 
     pbbs::sample_sort(A, n, lessE);
@@ -145,7 +145,8 @@ struct build {
   template<class Seq, class Bin_Op>
   static pbbs::range<ET*>
   sort_combine_duplicates_inplace(Seq const &A,  Bin_Op& f) {
-    auto less = [&] (ET a, ET b) {return Entry::comp(a.first, b.first);};
+    auto less = [&] (const ET& a, const ET& b) {
+      return Entry::comp(a.first, b.first);};
     pbbs::quicksort(A.begin(), A.size(), less);
     size_t j = 0;
     for (size_t i=1; i < A.size(); i++) {
@@ -155,4 +156,24 @@ struct build {
     return A.slice(0,j+1);
   }
 
+  // sorts by key, keeping only the last element of A for each key.
+  // get_key extracts the key from an element of A
+  template<class Seq, class GetKey>
+  static pbbs::sequence<typename Seq::value_type>
+  sort_keep_last(Seq const &A, const GetKey& get_key) {
+    using T = typename Seq::value_type;
+    size_t n = A.size();
+    if (n == 0) return pbbs::sequence<T>(0);
+    // ties broken by position so the result does not depend on stability
+    auto less = [&] (size_t i, size_t j) {
+      K ki = get_key(A[i]), kj = get_key(A[j]);
+      return Entry::comp(ki, kj) || (!Entry::comp(kj, ki) && i < j);};
+    pbbs::sequence<size_t> I(n, [] (size_t i) {return i;});
+    I = pbbs::sample_sort(I, less);
+    auto last = [&] (size_t i) {
+      return (i == n-1) || Entry::comp(get_key(A[I[i]]), get_key(A[I[i+1]]));};
+    return pbbs::pack(pbbs::dseq(n, [&] (size_t i) {return A[I[i]];}),
+		      pbbs::dseq(n, last));
+  }
+
 };
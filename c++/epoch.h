@@ -0,0 +1,165 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <thread>
+#include <iostream>
+
+// *******************************************
+//   EPOCH BASED RECLAMATION
+//   Readers pin the current epoch for the duration of a read.
+//   Writers retire objects instead of freeing them, and a retired
+//   object is only freed once every thread that was pinned when it
+//   was retired has unpinned (i.e. two epochs later).
+//   Pins are per thread and may nest.  Each thread claims one of
+//   max_threads slots the first time it pins or retires.  A slot holds
+//   the thread's announcement and the objects it has retired, so
+//   writers on different threads do not share a lock.
+// *******************************************
+
+namespace epoch {
+
+  constexpr size_t max_threads = 1024;
+  constexpr size_t quiescent = std::numeric_limits<size_t>::max();
+
+  // retired objects are collected once this many have accumulated
+  constexpr size_t collect_limit = 64;
+
+  struct retired {
+    void* p; void (*free_f)(void*); size_t epoch;
+  };
+
+  struct alignas(64) slot {
+    std::atomic<size_t> announced{quiescent};
+    std::mutex lock;  // protects limbo, only contended by flush
+    std::vector<retired> limbo;
+  };
+
+  struct state {
+    std::atomic<size_t> global{0};
+    std::atomic<size_t> num_slots{0};
+    slot slots[max_threads];
+  };
+
+  inline state& get_state() {
+    static state s;
+    return s;
+  }
+
+  struct thread_info {
+    slot* s = nullptr;
+    size_t depth = 0;
+  };
+
+  inline thread_info& my_info() {
+    static thread_local thread_info info;
+    return info;
+  }
+
+  inline slot* my_slot() {
+    thread_info& info = my_info();
+    if (!info.s) {
+      size_t i = get_state().num_slots.fetch_add(1);
+      if (i >= max_threads) {
+	std::cout << "epoch: too many threads" << std::endl;
+	abort();
+      }
+      info.s = &get_state().slots[i];
+    }
+    return info.s;
+  }
+
+  // announce the current epoch, re-reading until it is stable
+  inline void pin() {
+    thread_info& info = my_info();
+    if (info.depth++ > 0) return;
+    slot* s = my_slot();
+    state& st = get_state();
+    size_t e = st.global.load();
+    while (true) {
+      s->announced.store(e);
+      size_t e2 = st.global.load();
+      if (e2 == e) break;
+      e = e2;
+    }
+  }
+
+  inline void unpin() {
+    thread_info& info = my_info();
+    if (--info.depth > 0) return;
+    info.s->announced.store(quiescent);
+  }
+
+  // advances the global epoch if every pinned thread has seen it
+  inline bool try_advance() {
+    state& st = get_state();
+    size_t e = st.global.load();
+    size_t n = std::min(st.num_slots.load(), max_threads);
+    for (size_t i = 0; i < n; i++) {
+      size_t a = st.slots[i].announced.load();
+      if (a != quiescent && a != e) return false;
+    }
+    st.global.compare_exchange_strong(e, e+1);
+    return true;
+  }
+
+  // frees the objects retired into s that are at least two epochs
+  // old, returns the number still waiting
+  inline size_t collect(slot* s) {
+    state& st = get_state();
+    try_advance();
+    size_t e = st.global.load();
+    std::vector<retired> ready;
+    size_t remaining;
+    {
+      std::lock_guard<std::mutex> g(s->lock);
+      size_t j = 0;
+      for (size_t i = 0; i < s->limbo.size(); i++) {
+	if (s->limbo[i].epoch + 2 <= e) ready.push_back(s->limbo[i]);
+	else s->limbo[j++] = s->limbo[i];
+      }
+      s->limbo.resize(j);
+      remaining = j;
+    }
+    for (retired& r : ready) r.free_f(r.p);
+    return remaining;
+  }
+
+  // collects the objects retired by the calling thread
+  inline size_t collect() { return collect(my_slot()); }
+
+  // defer free_f(p) until no reader can still hold p
+  inline void retire(void* p, void (*free_f)(void*)) {
+    slot* s = my_slot();
+    size_t n;
+    {
+      std::lock_guard<std::mutex> g(s->lock);
+      s->limbo.push_back(retired{p, free_f, get_state().global.load()});
+      n = s->limbo.size();
+    }
+    if (n >= collect_limit && my_info().depth == 0) collect(s);
+  }
+
+  // blocks until everything retired so far, by any thread, has been
+  // freed.  must not be called while the calling thread is pinned.
+  inline void flush() {
+    state& st = get_state();
+    while (true) {
+      size_t n = std::min(st.num_slots.load(), max_threads);
+      size_t remaining = 0;
+      for (size_t i = 0; i < n; i++) remaining += collect(&st.slots[i]);
+      if (remaining == 0) return;
+      std::this_thread::yield();
+    }
+  }
+
+  // RAII pin
+  struct guard {
+    guard() { pin(); }
+    ~guard() { unpin(); }
+    guard(const guard&) = delete;
+    guard& operator = (const guard&) = delete;
+  };
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "basic_node.h"
 #include "utils.h"
+#include "epoch.h"
+#include "reclaim.h"
 
 // *******************************************
 //   GC
@@ -42,6 +44,59 @@ struct gc {
     }
   }
 
+  // drops an owner's reference to a root
+  static void drop(node* t) {
+    if (t) release(t);
+  }
+
+  // drops a reference to a root that readers pinned in the current
+  // epoch may still see, once none of them can (see epoch.h)
+  static void retire(node* t) {
+    if (t) epoch::retire(t, [] (void* p) {release((node*) p);});
+  }
+
+  // can the background reclamation service free these nodes
+  static constexpr bool reclaimable = reclaim::frees_anywhere<alloc>::value;
+
+  // decrements t, handing it to the background reclamation service
+  // (see reclaim.h) if it is running, can free t's nodes, and t is
+  // likely to be freed
+  static void release(node* t) {
+    if constexpr (reclaimable) {
+      if (reclaim::running() && t->ref_cnt == 1) {
+	reclaim::enqueue(t, reclaim_free);
+	return;
+      }
+    }
+    decrement_recursive(t);
+  }
+
+  // subtrees at least this large are split off as separate jobs
+  static constexpr size_t reclaim_grain = 1 << 14;
+
+  // runs on a reclamation thread, so does not fork
+  static void reclaim_free(void* p) {
+    node* t = (node*) p;
+    node* lsub = t->lc;
+    node* rsub = t->rc;
+    if (decrement(t)) {
+      for (node* c : {lsub, rsub}) {
+	if (Node::size(c) >= reclaim_grain) reclaim::enqueue(c, reclaim_free);
+	else decrement_recursive_seq(c);
+      }
+    }
+  }
+
+  static void decrement_recursive_seq(node* t) {
+    if (!t) return;
+    node* lsub = t->lc;
+    node* rsub = t->rc;
+    if (decrement(t)) {
+      decrement_recursive_seq(lsub);
+      decrement_recursive_seq(rsub);
+    }
+  }
+
   // atomically increment the reference count
   static void increment(node* t) {
     if (t) { pbbs::write_add(&t->ref_cnt, 1);}
@@ -60,10 +115,19 @@ struct gc {
     return o;
   }
 
+  // nodes with pending tags (see tagged_augmented_node.h)
+  template <class N, class = void>
+  struct has_tags : std::false_type {};
+  template <class N>
+  struct has_tags<N, std::void_t<typename N::tag_t>> : std::true_type {};
+
   // copy node if reference count is > 1, incrementing the children's ref counts
   // then decrements the copied node's count
   // does not update
+  // A tagged node also has its tag pushed to its children, since the
+  // caller is about to change them.
   static inline node* copy_if_needed(node* t) {
+    if constexpr (has_tags<Node>::value) return Node::template own<gc>(t);
     node* res = t;
     if (t->ref_cnt > 1) {
       res = copy(t);
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <type_traits>
+#include "utils.h"
+
+// *******************************************
+//   ADAPTIVE GRANULARITY
+//   The tree traversals (map_reduce, filter, foreach_index, map_filter)
+//   run subtrees smaller than a cutoff sequentially.  A fixed cutoff
+//   (node_limit) is too small when the per-entry work is cheap and too
+//   large when it is expensive.  Callers opt in by passing
+//   grain = auto_grain, and the traversals then ask a grain_control for
+//   the cutoff.  It keeps a running average of the time per node of the
+//   sequential leaves, measured on every sample_rate-th leaf a thread
+//   runs, and picks the cutoff so that a leaf takes about grain_leaf_ns.
+//   There is one controller per operation and function type, so
+//   different traversals adapt independently.
+//   The default grain is still node_limit, and any other grain
+//   (including 0, which always forks) is used as given.
+// *******************************************
+
+namespace utils {
+  // passing this as the grain runs sequentially
+  constexpr size_t no_fork = std::numeric_limits<size_t>::max();
+
+  // passing this as the grain selects the adaptive cutoff
+  constexpr size_t auto_grain = no_fork - 1;
+
+  // should a traversal fork on a subtree of n nodes.  Under auto_grain
+  // this is for the parts that are not a whole subtree, e.g. the spine
+  // of a range, which fork as with node_limit and hand their whole
+  // subtrees to the adaptive traversals.
+  inline bool grain_forks(size_t n, size_t grain) {
+    return n >= (grain == auto_grain ? node_limit : grain);
+  }
+
+  // target time of a sequential leaf, in nanoseconds
+  inline double grain_leaf_ns = 10000;
+
+  struct grain_control {
+    static constexpr size_t min_cutoff = 16;
+    static constexpr size_t max_cutoff = 1 << 16;
+    static constexpr size_t sample_rate = 8;
+    // leaves smaller than this are too short to time
+    static constexpr size_t min_sample = 8;
+
+    std::atomic<double> ns_per_node{0.0};
+
+    // subtrees with fewer nodes than this should run sequentially
+    size_t cutoff() const {
+      double c = ns_per_node.load(std::memory_order_relaxed);
+      if (c <= 0) return node_limit;
+      double n = grain_leaf_ns / c;
+      if (n < min_cutoff) return min_cutoff;
+      if (n > max_cutoff) return max_cutoff;
+      return (size_t) n;
+    }
+
+    // adds a measurement of ns nanoseconds for a leaf of n nodes.
+    // Races between leaves only lose a measurement.
+    void record(double ns, size_t n) {
+      double x = ns / n;
+      double c = ns_per_node.load(std::memory_order_relaxed);
+      ns_per_node.store((c <= 0) ? x : c + (x - c) / 8,
+			std::memory_order_relaxed);
+    }
+
+    // runs the sequential leaf f over n nodes, timing some of them.
+    // Leaves are counted per thread, so counting shares no cache line.
+    template <class F>
+    auto leaf(size_t n, const F& f) -> decltype(f()) {
+      static thread_local size_t leaves = 0;
+      if (n < min_sample || leaves++ % sample_rate != 0) return f();
+      using clock = std::chrono::steady_clock;
+      auto start = clock::now();
+      auto done = [&] () {
+	std::chrono::duration<double, std::nano> t = clock::now() - start;
+	record(t.count(), n);
+      };
+      if constexpr (std::is_void<decltype(f())>::value) {
+	f(); done();
+      } else {
+	auto r = f(); done();
+	return r;
+      }
+    }
+  };
+
+  // the controller for the traversal whose sequential leaf is Leaf.
+  // Each traversal uses a local lambda for its leaf, so its type
+  // identifies the operation, the tree and the user function.
+  template <class Leaf>
+  inline grain_control grain_for;
+}
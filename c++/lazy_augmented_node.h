@@ -0,0 +1,94 @@
+#pragma once
+#include "augmented_node.h"
+#include "utils.h"
+
+// *******************************************
+//   LAZY AUGMENTED NODE
+// *******************************************
+
+// An augmented node whose augmented value is computed on demand.
+// Joins and rotations only mark a node dirty.  The first query that
+// reads a dirty node's value (aug_val, aug_left, aug_range, aug_select,
+// aug_filter, ...) computes it, recursing in parallel into dirty
+// subtrees, and caches it in the node.  Useful when the augmentation is
+// expensive (e.g. a nested map) and only a few queries read it.
+// Nodes can be shared between threads, so the cache is claimed with a
+// CAS.  A reader that loses the race computes the value itself without
+// caching it, rather than waiting.
+// The Entry interface is the same as for aug_node.
+
+template <class ET, class AT>
+struct lazy_aug_entry {
+  ET first;
+  AT second;
+  unsigned char state;
+};
+
+template<class balance, class Entry,
+	 template<class> class Allocator = pool_allocator>
+struct lazy_aug_node
+  : basic_node<balance, lazy_aug_entry<typename Entry::entry_t,
+				       typename Entry::aug_t>,
+	       Allocator> {
+  using AT = typename Entry::aug_t;
+  using ET = typename Entry::entry_t;
+  using basic = basic_node<balance, lazy_aug_entry<ET,AT>, Allocator>;
+  using node = typename basic::node;
+  using strict = aug_node<balance, Entry, Allocator>;
+
+  enum : unsigned char {clean, dirty, busy};
+
+  static ET& get_entry(node *a) {return a->entry.first;}
+  static ET* get_entry_p(node *a) {return &a->entry.first;}
+  template <class T>
+  static void set_entry(node *a, T&& e) {a->entry.first = std::forward<T>(e);}
+
+  static void combine_into(AT& a, const AT& b) { strict::combine_into(a, b); }
+
+  // computes the value of a from its children, without caching it
+  static AT compute(node* a) {
+    auto P = utils::fork<AT>(basic::size(a) >= utils::node_limit,
+      [&] () {return a->lc ? aug_val(a->lc) : AT();},
+      [&] () {return a->rc ? aug_val(a->rc) : AT();});
+    AT av = a->lc ? std::move(P.first) : Entry::from_entry(get_entry(a));
+    if (a->lc) combine_into(av, Entry::from_entry(get_entry(a)));
+    if (a->rc) combine_into(av, P.second);
+    return av;
+  }
+
+  static AT aug_val(node* a) {
+    if (a == NULL) return Entry::get_empty();
+    unsigned char* s = &(a->entry).state;
+    unsigned char d = dirty;
+    if (__atomic_load_n(s, __ATOMIC_ACQUIRE) == clean)
+      return (a->entry).second;
+    if (!__atomic_compare_exchange_n(s, &d, busy, false,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return (d == clean) ? (a->entry).second : compute(a);
+    (a->entry).second = compute(a);
+    __atomic_store_n(s, (unsigned char) clean, __ATOMIC_RELEASE);
+    return (a->entry).second;
+  }
+
+  // a is not null
+  static AT aug_ref(node* a) { return aug_val(a); }
+
+  // called on nodes that are not yet visible to other threads
+  static void update(node* a) {
+    basic::update(a);
+    (a->entry).state = dirty;
+  }
+
+  template<class F>
+  static void lazy_update(node* a, F f) { update(a); }
+
+  template <class T>
+  static node* make_node(T&& e) {
+    return basic::make_node(lazy_aug_entry<ET,AT>{std::forward<T>(e), AT(), dirty});
+  }
+
+  template <class T>
+  static node* single(T&& e) {
+    return basic::single(lazy_aug_entry<ET,AT>{std::forward<T>(e), AT(), dirty});
+  }
+};
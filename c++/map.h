@@ -2,6 +2,8 @@
 
 using namespace std;
 
+template <class Map> class transient_map;
+
 // *******************************************
 //   MAPS
 // *******************************************
@@ -110,7 +112,7 @@ public:
 	node* t = root;
 	if (__sync_bool_compare_and_swap(&(this->root), t, NULL)) {
 		if (GC::initialized())
-			GC::decrement_recursive(t);
+			GC::drop(t);
 	}
   }
 
@@ -156,7 +158,7 @@ public:
 
   // flatten all entries to a sequence
   static pbbs::sequence<E> entries(M m, size_t granularity=utils::node_limit) {
-    auto f = [] (E e) -> E {return e;};
+    auto f = [] (const E& e) -> E {return e;};
     return to_seq<E>(m, f, granularity);
   }
 
@@ -212,6 +214,17 @@ public:
     return M(Tree::join2(a.get_root(), b.get_root()));
   }
 
+  // single-owner mutable handle, see transient_map.h
+  static transient_map<M> to_transient(M m) {
+    return transient_map<M>(std::move(m)); }
+
+  // moves the top levels, which every worker traverses, to memory
+  // interleaved across NUMA nodes.  Only changes placement with
+  // numa_allocator (see allocators.h).
+  static M interleave_top(M m, size_t levels = 10) {
+    numa::interleave_guard g;
+    return M(Tree::copy_top(m.get_root(), levels)); }
+
   bool is_empty() {return root == NULL;}
 
   // filters elements that satisfy the predicate when applied to the elements.
@@ -226,13 +239,22 @@ public:
   
   // determines if there is any entry in the tree satisfying indicator f
   template<class F>
-  static bool if_exist(M m, const F& f) {
-	bool* indicator = new bool;
-	*indicator = false;
-    bool ans = Tree::if_exist(m.get_root(), f, indicator); 
-	delete indicator;
-	return ans;
-  }
+  static bool if_exist(const M& m, const F& f) {return any_of(m, f);}
+
+  template<class F>
+  static bool any_of(const M& m, const F& f) {
+    return Tree::any_of(m.root, f);}
+
+  // some entry satisfying f, stopping the search once one is found
+  template<class F>
+  static maybe_E find_if(const M& m, const F& f) {
+    utils::cancel_token c;
+    return m.node_to_entry(Tree::find_if(m.root, f, c));}
+
+  // the entry with the smallest key satisfying f
+  template<class F>
+  static maybe_E first_match(const M& m, const F& f) {
+    return m.node_to_entry(Tree::first_match(m.root, f));}
     
   // insert multiple keys from an array
   template<class Seq>
@@ -276,8 +298,8 @@ public:
       using key_t = K;
       using val_t = VV;
       static bool comp(const key_t& a, const key_t& b) {return a<b;}
-      static inline key_t get_key(const entry_t& e) {return e.first;}
-      static inline val_t get_val(const entry_t& e) {return e.second;}
+      static inline const key_t& get_key(const entry_t& e) {return e.first;}
+      static inline const val_t& get_val(const entry_t& e) {return e.second;}
       static inline void set_val(entry_t& e, const val_t& v) {e.second = v;}
     };
 		
@@ -287,10 +309,48 @@ public:
 				       B.size(), f));
   }
 
+  // delete multiple keys given in a sequence
+  template<class Seq>
+  static M multi_delete(M m, Seq const &SS) {
+    auto less = [&] (const K& a, const K& b) {return Entry::comp(a,b);};
+    pbbs::sequence<K> B = pbbs::sample_sort(SS, less);
+    auto first = [&] (size_t i) {return (i==0) || less(B[i-1], B[i]);};
+    pbbs::sequence<K> C = pbbs::pack(B, pbbs::dseq(B.size(), first));
+    return M(Tree::multi_delete_sorted(m.get_root(), C.begin(), C.size()));
+  }
+
+  // delete multiple keys from a sorted sequence with no duplicates
+  template<class Seq>
+  static M multi_delete_sorted(M m, Seq const &SS) {
+    return M(Tree::multi_delete_sorted(m.get_root(), SS.begin(), SS.size()));
+  }
+
+  // apply a batch of tagged inserts, updates and deletes in one pass
+  // (see map_ops::multi_apply_sorted).  Updates combine with f(old, new).
+  // If a key appears more than once only its last operation is applied.
+  using batch_op = typename Tree::batch_op;
+  using tagged_op = typename Tree::tagged_op;
+  static constexpr batch_op batch_insert = Tree::batch_insert;
+  static constexpr batch_op batch_update = Tree::batch_update;
+  static constexpr batch_op batch_delete = Tree::batch_delete;
+
+  template<class Seq, class Bin_Op>
+  static M multi_apply(M m, Seq const &SS, Bin_Op f) {
+    auto get_key = [] (const tagged_op& a) {return Entry::get_key(a.first);};
+    pbbs::sequence<tagged_op> B = Build::sort_keep_last(SS, get_key);
+    return M(Tree::multi_apply_sorted(m.get_root(), B.begin(), B.size(), f));
+  }
+
+  template<class Seq>
+  static M multi_apply(M m, Seq const &SS) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    return multi_apply(std::move(m), SS, replace);
+  }
+
   template<class Seq>
   static V* multi_find(M m, Seq const &SS) {
     using K = typename Seq::value_type;
-    auto less = [&] (K& a, K &b) {return Entry::comp(a,b);};
+    auto less = [&] (const K& a, const K& b) {return Entry::comp(a,b);};
     pbbs::sequence<K> B = pbbs::sample_sort(SS, less);
     V* ret = new V[B.size()];
     Tree::multi_find_sorted(m.get_root(), B.begin(),
@@ -298,6 +358,33 @@ public:
     return ret;
   }
   
+  // Batched lookup.  out[i] is set to the value for key SS[i], or to an
+  // empty maybe if it is absent.  Sorted queries are answered with no
+  // allocation, otherwise the (key, position) pairs are sorted first.
+  template<class Seq>
+  static void multi_find(const M& m, Seq const &SS, maybe_V* out) {
+    size_t n = SS.size();
+    bool sorted = true;
+    for (size_t i = 1; i < n && sorted; i++)
+      sorted = !Entry::comp(SS[i], SS[i-1]);
+    if (sorted) {
+      Tree::multi_find_sorted(m.root, SS.begin(), n, out);
+      return;
+    }
+    using KI = std::pair<K,size_t>;
+    auto less = [&] (const KI& a, const KI& b) {
+      return Entry::comp(a.first, b.first);};
+    pbbs::sequence<KI> B(n, [&] (size_t i) {return KI(SS[i], i);});
+    B = pbbs::sample_sort(B, less);
+    Tree::multi_find_indexed(m.root, B.begin(), n, out);
+  }
+
+  // as above for keys sorted by Entry::comp
+  template<class Seq>
+  static void multi_find_sorted(const M& m, Seq const &SS, maybe_V* out) {
+    Tree::multi_find_sorted(m.root, SS.begin(), SS.size(), out);
+  }
+
   // insert multiple keys from an array
   template<class Seq>
   static M multi_insert_sorted(M m, Seq const &SS, bool seq_inplace = false) {
@@ -306,6 +393,20 @@ public:
 				       SS.size(), replace));
   }
 
+  // insert multiple keys from a sorted array with no duplicates, at
+  // or near the end of m (e.g. time-keyed streams)
+  template<class Seq>
+  static M append_sorted(M m, Seq const &SS) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    return M(Tree::append_sorted(m.get_root(), SS.begin(), SS.size(),
+				 replace));
+  }
+
+  template<class Seq, class Bin_Op>
+  static M append_sorted(M m, Seq const &SS, const Bin_Op& f) {
+    return M(Tree::append_sorted(m.get_root(), SS.begin(), SS.size(), f));
+  }
+
   // insert multiple keys from an array, combine duplicates with f
   // here f must have type: V x V -> V
   // if key in map, then also combined with f
@@ -368,6 +469,19 @@ public:
   maybe_E previous(const K& key) const {
       return node_to_entry(Tree::previous(root, key));}
 
+  // in-order iterators, see map_iterator.h
+  using iterator = map_iterator<Tree>;
+  iterator begin() const { return iterator::first(root); }
+  iterator end() const { return iterator(root); }
+
+  // first entry with key >= key
+  iterator seek(const K& key) const { return iterator::seek(root, key); }
+
+  // the entries with keys in [key_left, key_right]
+  map_range<Tree> range_view(const K& key_left, const K& key_right) const {
+    return map_range<Tree>(iterator::seek(root, key_left),
+			   iterator::seek(root, key_right, true));}
+
   // rank and select
   size_t rank(const K& key) { return Tree::rank(root, key);}
 
@@ -383,7 +497,7 @@ public:
   }
 
   static M map_union(M a, M b, bool extra = false) {
-    auto get_right = [] (V a, V b) {return b;};
+    auto get_right = [] (const V& a, const V& b) {return b;};
     auto x = M(Tree::uniont(a.get_root(), b.get_root(), get_right, extra));
     return x;
   }
@@ -397,34 +511,61 @@ public:
   }
 
   static M map_intersect(M a, M b) {
-    auto get_right = [] (V a, V b) {return b;};
+    auto get_right = [] (const V& a, const V& b) {return b;};
     return M(Tree::template intersect<Tree,Tree>(a.get_root(),
 						 b.get_root(), get_right));
   }
 
+  // union and intersection of all the maps in ms (a sequence of M),
+  // building one result tree rather than folding binary operations.
+  // op combines the values of equal keys in the order of the maps.
+  template<class Seq, class F>
+  static M map_union_k(Seq ms, const F& op) {
+    std::vector<node*> B = take_roots(ms);
+    return M(Tree::union_k(B.data(), B.size(), op));
+  }
+
+  template<class Seq>
+  static M map_union_k(Seq ms) {
+    auto get_right = [] (const V& a, const V& b) {return b;};
+    return map_union_k(std::move(ms), get_right);
+  }
+
+  template<class Seq, class F>
+  static M map_intersect_k(Seq ms, const F& op) {
+    std::vector<node*> B = take_roots(ms);
+    return M(Tree::intersect_k(B.data(), B.size(), op));
+  }
+
+  template<class Seq>
+  static M map_intersect_k(Seq ms) {
+    auto get_right = [] (const V& a, const V& b) {return b;};
+    return map_intersect_k(std::move(ms), get_right);
+  }
+
   static M map_difference(M a, M b) {
     return M(Tree::difference(a.get_root(), b.get_root()));
   }
 
-  static M range(M& a, K kl, K kr) {
+  static M range(M& a, const K& kl, const K& kr) {
     return M(Tree::range(a.root, kl, kr));
   }
 
-  static M range_number(M& a, K kl, size_t r) {
+  static M range_number(M& a, const K& kl, size_t r) {
     return M(Tree::range_num(a.root, kl, r));
   }
   
   template<class Map, class Reduce>
-  static typename Reduce::T range_number_mr(M& a, K kl, size_t r, const Map& mp, const Reduce& rdc) {
+  static typename Reduce::T range_number_mr(M& a, const K& kl, size_t r, const Map& mp, const Reduce& rdc) {
     auto x = Tree::range_num_mr(a.root, kl, r, mp, rdc);
     return x.first;
   }
   
-  static M upTo(M& a, K kr) {
+  static M upTo(M& a, const K& kr) {
     return M(Tree::left(a.root, kr));
   }
   
-  static M downTo(M& a, K kr) {
+  static M downTo(M& a, const K& kr) {
     return M(Tree::right(a.root, kr));
   }
 
@@ -439,6 +580,19 @@ public:
     GC::init();
     return M(Tree::template map_set<typename Ma::Tree>(a.root, f));
   }
+
+  // For a map of this type, map and map_set consume the input, so when
+  // it is not shared (e.g. a temporary or std::move'd) its nodes are
+  // reused instead of allocating a new tree.
+  template<class F>
+  static M map(M a, const F& f) {
+    return M(Tree::map_inplace(a.get_root(), f));
+  }
+
+  template<class F>
+  static M map_set(M a, const F& f) {
+    return M(Tree::map_set_inplace(a.get_root(), f));
+  }
   
   template<class F>
   static void map_index(M& m, const F& f,
@@ -459,6 +613,22 @@ public:
     return Tree::template map_reduce<R>(m.root, f, r, grain);
   }
 
+  // map_reduce over the entries with keys in [kl, kr], without
+  // building the range as a tree
+  template<class R, class F>
+  static typename R::T map_reduce_range(const M& m, const K& kl, const K& kr,
+					const F& f, const R& r,
+					size_t grain=utils::node_limit) {
+    return Tree::template map_reduce_range<R>(m.root, kl, kr, f, r, grain);
+  }
+
+  // apply f(e, i) to the i-th entry with key in [kl, kr]
+  template <class F>
+  static void foreach_range(const M& m, const K& kl, const K& kr, const F& f,
+			    size_t granularity = utils::node_limit) {
+    Tree::foreach_range(m.root, kl, kr, f, granularity);
+  }
+
   template<class F>
   static void map_void(M& m, const F& f,
 		       size_t granularity=utils::node_limit) {
@@ -467,7 +637,7 @@ public:
       static T identity() {return false;}
       static T add(T a, T b) {return false;}
     };
-    auto g = [&] (E v) {f(v); return false;};
+    auto g = [&] (E& v) {f(v); return false;};
     Tree::map_reduce(m.root, g, do_nothing(), granularity);
   }
 
@@ -475,10 +645,23 @@ public:
   static  M map_filter(const Ma& a, const F& f, size_t granularity=utils::node_limit) {
     return M(Tree::template map_filter<typename Ma::Tree>(a.root, f, granularity));
   }
+
+  // consumes a, reusing its nodes that are not shared
+  template<class F>
+  static M map_filter(M a, const F& f) {
+    return M(Tree::map_filter_inplace(a.get_root(), f));
+  }
   
   // grabs root by "moving" it.  Important for reuse
   node* get_root() {node* t = root; root = NULL; return t;};
 
+  template<class Seq>
+  static std::vector<node*> take_roots(Seq& ms) {
+    std::vector<node*> B(ms.size());
+    for (size_t j = 0; j < B.size(); j++) B[j] = ms[j].get_root();
+    return B;
+  }
+
   node* root;
 
   // construct from a node (perhaps should be private)
@@ -502,17 +685,19 @@ struct map_full_entry : entry {
   using val_t = typename entry::val_t;
   using key_t = typename entry::key_t;
   using entry_t = std::pair<key_t,val_t>;
-  static inline key_t get_key(const entry_t& e) {return e.first;}
-  static inline val_t get_val(const entry_t& e) {return e.second;}
+  static inline const key_t& get_key(const entry_t& e) {return e.first;}
+  static inline const val_t& get_val(const entry_t& e) {return e.second;}
   static inline void set_val(entry_t& e, const val_t& v) {e.second = v;}
 };
 
-template <class _Entry, class Balance=weight_balanced_tree>
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
 using pam_map =
   map_<map_full_entry<_Entry>,
        typename Balance::template
        balance<basic_node<typename Balance::data,
-			  typename map_full_entry<_Entry>::entry_t>>>;
+			  typename map_full_entry<_Entry>::entry_t,
+			  Allocator>>>;
 
 // entry is just the key (no value), for use in sets
 template <class entry>
@@ -520,17 +705,18 @@ struct set_full_entry : entry {
   using key_t = typename entry::key_t;
   using val_t = bool;  // not used
   using entry_t = key_t;
-  static inline key_t get_key(const entry_t& e) {return e;}
+  static inline const key_t& get_key(const entry_t& e) {return e;}
   static inline val_t get_val(const entry_t& e) {return 0;}
   static inline void set_val(entry_t& e, const val_t& v) {}
 };
 
-template <class _Entry, class Balance=weight_balanced_tree>
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
 using pam_set =
   map_<set_full_entry<_Entry>,
        typename Balance::template
        balance<basic_node<typename Balance::data,
-			  typename _Entry::key_t>>>;
+			  typename _Entry::key_t, Allocator>>>;
 
 // entry is just a value (no key), for use in sequences
 template <class data>
@@ -539,14 +725,15 @@ struct seq_full_entry {
   using val_t = bool;  // not used
   using entry_t = data;
   static bool comp(const key_t& a, const key_t& b) {return true;}
-  static inline key_t get_key(const entry_t& e) {return e;}
+  static inline const key_t& get_key(const entry_t& e) {return e;}
   static inline val_t get_val(const entry_t& e) {return 0;}
   static inline void set_val(entry_t& e, const val_t& v) {}
 };
 
 // data can be any type
-template <typename data, class Balance=weight_balanced_tree>
+template <typename data, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
 using pam_seq =
   map_<seq_full_entry<data>,
        typename Balance::template
-       balance<basic_node<typename Balance::data, data>>>;
+       balance<basic_node<typename Balance::data, data, Allocator>>>;
@@ -0,0 +1,132 @@
+#pragma once
+#include <iterator>
+#include <cstddef>
+#include <iostream>
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+
+// *******************************************
+//   ITERATORS
+//   Bidirectional in-order iterators over a tree, keeping the path from
+//   the root on a fixed size stack, so iterating allocates nothing and
+//   does not touch reference counts.  The tree must stay alive and must
+//   not be updated in place while it is being iterated.
+// *******************************************
+
+template <class Tree>
+class map_iterator {
+public:
+  using node = typename Tree::node;
+  using Entry = typename Tree::Entry;
+  using K = typename Entry::key_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename Tree::ET;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const value_type*;
+  using reference = const value_type&;
+
+  // deep enough for any balanced tree that fits in memory
+  static constexpr int max_depth = 128;
+
+  map_iterator() : root(NULL), depth(0) {}
+
+  // the end iterator of the tree rooted at r
+  explicit map_iterator(node* r) : root(r), depth(0) {}
+
+  static map_iterator first(node* r) {
+    map_iterator it(r);
+    it.push_leftmost(r);
+    return it;
+  }
+
+  // first entry with key >= k (or > k if strict)
+  static map_iterator seek(node* r, const K& k, bool strict = false) {
+    map_iterator it(r);
+    int found = 0;
+    node* b = r;
+    while (b) {
+      it.push(b);
+      bool right = strict ? !Entry::comp(k, Tree::get_key(b))
+	                  : Entry::comp(Tree::get_key(b), k);
+      if (right) b = b->rc;
+      else {found = it.depth; b = b->lc;}
+    }
+    it.depth = found;
+    return it;
+  }
+
+  reference operator * () const { return Tree::get_entry(stack[depth-1]); }
+  pointer operator -> () const { return &Tree::get_entry(stack[depth-1]); }
+
+  map_iterator& operator ++ () {
+    node* c = stack[depth-1];
+    if (c->rc) push_leftmost(c->rc);
+    else {
+      depth--;
+      while (depth > 0 && stack[depth-1]->rc == c) c = stack[--depth];
+    }
+    return *this;
+  }
+
+  map_iterator& operator -- () {
+    if (depth == 0) {push_rightmost(root); return *this;}
+    node* c = stack[depth-1];
+    if (c->lc) push_rightmost(c->lc);
+    else {
+      depth--;
+      while (depth > 0 && stack[depth-1]->lc == c) c = stack[--depth];
+    }
+    return *this;
+  }
+
+  map_iterator operator ++ (int) { map_iterator t = *this; ++*this; return t; }
+  map_iterator operator -- (int) { map_iterator t = *this; --*this; return t; }
+
+  bool operator == (const map_iterator& o) const { return current() == o.current(); }
+  bool operator != (const map_iterator& o) const { return !(*this == o); }
+
+  bool is_end() const { return depth == 0; }
+
+private:
+  node* root;
+  int depth;
+  node* stack[max_depth];
+
+  node* current() const { return depth == 0 ? NULL : stack[depth-1]; }
+
+  void push(node* b) {
+    if (depth == max_depth) {
+      std::cout << "map_iterator: tree too deep" << std::endl;
+      abort();
+    }
+    stack[depth++] = b;
+  }
+
+  void push_leftmost(node* b) { while (b) {push(b); b = b->lc;} }
+  void push_rightmost(node* b) { while (b) {push(b); b = b->rc;} }
+};
+
+// The entries with keys in [key_left, key_right], for use in range-for
+// loops (and as a std::ranges view when compiled as C++20).
+template <class Tree>
+class map_range
+#if __cplusplus >= 202002L
+  : public std::ranges::view_base
+#endif
+{
+public:
+  using iterator = map_iterator<Tree>;
+  using node = typename Tree::node;
+  using K = typename iterator::K;
+
+  map_range() {}
+  map_range(iterator b, iterator e) : b(b), e(e) {}
+
+  iterator begin() const { return b; }
+  iterator end() const { return e; }
+  bool empty() const { return b == e; }
+
+private:
+  iterator b, e;
+};
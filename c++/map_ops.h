@@ -1,7 +1,9 @@
 #pragma once
+#include <vector>
 #include "utils.h"
 #include "pbbslib/sequence.h"
 #include "pbbslib/binary_search.h"
+#include "pbbslib/sequence_ops.h"
 
 // *******************************************
 //   MAPS and SETS
@@ -16,11 +18,12 @@ struct map_ops : Seq {
   using K = typename Entry::key_t;
   using V = typename Entry::val_t;
 
-  static bool comp(K a, K b) { return Entry::comp(a,b);}
-  static K get_key(node *s) { return Entry::get_key(*Seq::get_entry_p(s));}
-  static V get_val(node *s) { return Entry::get_val(*Seq::get_entry_p(s));}
-  //static K get_key(node *s) { return Entry::get_key(Seq::get_entry(s));}
-  //static V get_val(node *s) { return Entry::get_val(Seq::get_entry(s));}
+  static bool comp(const K& a, const K& b) { return Entry::comp(a,b);}
+  // references into the node when the Entry returns them
+  static decltype(auto) get_key(node *s) {
+    return Entry::get_key(*Seq::get_entry_p(s));}
+  static decltype(auto) get_val(node *s) {
+    return Entry::get_val(*Seq::get_entry_p(s));}
   
   static node* find(node* b, const K& key) {
     while (b) {
@@ -33,9 +36,8 @@ struct map_ops : Seq {
   
   template <class BinaryOp>
   static inline void update_value(node* a, const BinaryOp& op) {
-    ET re = Seq::get_entry(a);
+    ET& re = Seq::get_entry(a);
     Entry::set_val(re, op(re));
-    Seq::set_entry(a, re);
   }
   
  
@@ -46,7 +48,7 @@ struct map_ops : Seq {
 	ET e = Seq::get_entry(nd);
 	V new_value = f(e);
 	ET new_entry = make_pair(key, new_value);
-	auto replace = [](V a, V b) {return b;};
+	auto replace = [](const V& a, const V& b) {return b;};
 	return insert(b, new_entry, replace);
   }*/
   
@@ -145,19 +147,88 @@ struct map_ops : Seq {
   }
 
   template <class BinaryOp>
-  static inline void combine_values(node* a, ET e, bool reverse, const BinaryOp& op) {
-    ET re = Seq::get_entry(a);
-	//std::cout << Entry::get_val(re) << " " << Entry::get_val(e) << std::endl;
+  static inline void combine_values(node* a, const ET& e, bool reverse,
+				    const BinaryOp& op) {
+    ET& re = Seq::get_entry(a);
     if (reverse) Entry::set_val(re, op(Entry::get_val(e), Entry::get_val(re)));
     else Entry::set_val(re, op(Entry::get_val(re), Entry::get_val(e)));
-    Seq::set_entry(a, re);
   }
   
   template <class VE, class BinaryOp>
-  static inline void update_valuev(node* a, VE v0, const BinaryOp& op) {
-    ET re = Seq::get_entry(a);
+  static inline void update_valuev(node* a, const VE& v0, const BinaryOp& op) {
+    ET& re = Seq::get_entry(a);
     Entry::set_val(re, op(Entry::get_val(re), v0));
-    Seq::set_entry(a, re);
+  }
+
+  // *******************************************
+  //   BASE CASES for SET OPERATIONS
+  //   Below utils::set_base_size entries intersection copies the node
+  //   pointers of both sides into per-thread buffers, merges them and
+  //   builds a balanced tree of the result, rather than splitting and
+  //   joining node by node.  It builds new nodes either way, so sharing
+  //   does not matter.  Union and difference reuse their input nodes,
+  //   and a shared subtree is path copied by the recursive case, which
+  //   keeps its untouched parts shared, so they have no base case.
+  // *******************************************
+
+  // Per-thread scratch space.  The base cases do not nest for a given
+  // node type, so each type needs a buffer per tag only.
+  template <class T, int tag = 0>
+  static T* scratch(size_t n) {
+    static thread_local std::vector<T> buf;
+    if (buf.size() < n) buf.resize(n);
+    return buf.data();
+  }
+
+  // writes the nodes of b in order, without touching reference counts
+  template <class N>
+  static N** collect(N* b, N** out) {
+    if (!b) return out;
+    out = collect(b->lc, out);
+    *out++ = b;
+    return collect(b->rc, out);
+  }
+
+  // a balanced tree from the detached nodes in A[0,n)
+  static node* from_nodes(node** A, size_t n) {
+    if (n == 0) return NULL;
+    size_t mid = n/2;
+    node* l = from_nodes(A, mid);
+    node* r = from_nodes(A + mid + 1, n - mid - 1);
+    return Seq::node_join(l, r, A[mid]);
+  }
+
+  static bool base_case(size_t n1, size_t n2) {
+    return n1 + n2 <= utils::set_base_size;
+  }
+
+  template <class Seq1, class Seq2, class BinaryOp>
+  static node* intersect_base(typename Seq1::node* b1,
+			      typename Seq2::node* b2,
+			      const BinaryOp& op, bool extra_b2) {
+    using N1 = typename Seq1::node;
+    using N2 = typename Seq2::node;
+    size_t n1 = Seq1::size(b1);   size_t n2 = Seq2::size(b2);
+    N1** A = scratch<N1*, 0>(n1);
+    N2** B = scratch<N2*, 1>(n2);
+    node** R = scratch<node*, 2>(std::min(n1, n2));
+    collect(b1, A);
+    collect(b2, B);
+    size_t i = 0, j = 0, k = 0;
+    while (i < n1 && j < n2) {
+      if (comp(Seq1::get_key(A[i]), Seq2::get_key(B[j]))) i++;
+      else if (comp(Seq2::get_key(B[j]), Seq1::get_key(A[i]))) j++;
+      else {
+	ET e(Seq2::get_key(B[j]),
+	     op(Seq1::Entry::get_val(Seq1::get_entry(A[i])),
+		Seq2::Entry::get_val(Seq2::get_entry(B[j]))));
+	R[k++] = Seq::make_node(e);
+	i++; j++;
+      }
+    }
+    Seq1::GC::decrement_recursive(b1);
+    if (!extra_b2) Seq2::GC::decrement_recursive(b2);
+    return from_nodes(R, k);
   }
 
   // Works in-place when possible.
@@ -191,6 +262,8 @@ struct map_ops : Seq {
     if (!b1) {if (!extra_b2) Seq2::GC::decrement_recursive(b2); return NULL;}
     if (!b2) {Seq1::GC::decrement_recursive(b1); return NULL;}
     size_t n1 = Seq1::size(b1);   size_t n2 = Seq2::size(b2);
+    if (base_case(n1, n2))
+      return intersect_base<Seq1,Seq2>(b1, b2, op, extra_b2);
     bool copy = extra_b2 || (b2->ref_cnt > 1);
     typename Seq1::split_info bsts = Seq1::split(b1, Seq2::get_key(b2));
 
@@ -230,7 +303,126 @@ struct map_ops : Seq {
       return Seq::join2(P.first, P.second);
     } else {
       return Seq::node_join(P.first, P.second, GC::copy_if(b1, copy, extra_b1));
-    }   
+    }
+  }
+
+  // *******************************************
+  //   K-WAY UNION and INTERSECTION
+  //   All k trees are split together by the root key of one of them
+  //   and the two halves are built recursively, so a single output
+  //   tree is built instead of k-1 intermediate ones.  Consumes the
+  //   trees in B[0,k).  Values of equal keys are combined with op in
+  //   the order of the inputs.
+  // *******************************************
+
+  // The pivot is the root of the tree at p, whose children have already
+  // been taken.  Its value becomes the op fold over the inputs that
+  // contain its key.
+  template <class BinaryOp>
+  static node* combine_k(node* r, size_t p, std::vector<ET>& E,
+			 std::vector<char>& found, const BinaryOp& op) {
+    size_t k = found.size();
+    size_t i = 0;
+    while (i < p && !found[i]) i++;
+    if (i == p) {
+      for (size_t j = p + 1; j < k; j++)
+	if (found[j]) combine_values(r, E[j], false, op);
+    } else {
+      ET e = std::move(E[i]);
+      for (size_t j = i + 1; j < k; j++)
+	if (j == p) Entry::set_val(e, op(Entry::get_val(e), get_val(r)));
+	else if (found[j]) Entry::set_val(e, op(Entry::get_val(e),
+						 Entry::get_val(E[j])));
+      Entry::set_val(Seq::get_entry(r), Entry::get_val(e));
+    }
+    return r;
+  }
+
+  // Splits every tree but B[p] by the root key of B[p].
+  static void split_k(node** B, size_t k, size_t p, bool copy,
+		      std::vector<node*>& L, std::vector<node*>& R,
+		      std::vector<ET>& E, std::vector<char>& found) {
+    const K& bk = get_key(B[p]);
+    for (size_t j = 0; j < k; j++) {
+      if (j == p) continue;
+      split_info s = split(B[j], bk);
+      L[j] = s.first;  R[j] = s.second;
+      if ((found[j] = s.removed)) E[j] = std::move(s.entry);
+    }
+    L[p] = GC::inc_if(B[p]->lc, copy);
+    R[p] = GC::inc_if(B[p]->rc, copy);
+  }
+
+  template <class BinaryOp>
+  static node* union_k(node** B, size_t k, const BinaryOp& op) {
+    // empty inputs are dropped, so sparse overlaps quickly fall back
+    // to the binary union
+    std::vector<node*> T;
+    for (size_t j = 0; j < k; j++) if (B[j]) T.push_back(B[j]);
+    k = T.size();
+    if (k == 0) return NULL;
+    if (k == 1) return T[0];
+    if (k == 2) return uniont(T[0], T[1], op);
+
+    // the largest tree gives the pivot, so it is never split
+    size_t p = 0, n = 0;
+    for (size_t j = 0; j < k; j++) {
+      n += Seq::size(T[j]);
+      if (Seq::size(T[j]) > Seq::size(T[p])) p = j;
+    }
+    size_t np = Seq::size(T[p]);
+    bool copy = T[p]->ref_cnt > 1;
+    std::vector<node*> L(k), R(k);
+    std::vector<ET> E(k);
+    std::vector<char> found(k, false);
+    split_k(T.data(), k, p, copy, L, R, E, found);
+
+    auto P = utils::fork<node*>(utils::do_parallel(np, n - np),
+      [&] () {return union_k(L.data(), k, op);},
+      [&] () {return union_k(R.data(), k, op);});
+
+    node* r = combine_k(GC::copy_if(T[p], copy, false), p, E, found, op);
+    return Seq::node_join(P.first, P.second, r);
+  }
+
+  template <class BinaryOp>
+  static node* intersect_k(node** B, size_t k, const BinaryOp& op) {
+    bool empty = (k == 0);
+    for (size_t j = 0; j < k; j++) if (!B[j]) empty = true;
+    if (empty) {
+      for (size_t j = 0; j < k; j++) GC::decrement_recursive(B[j]);
+      return NULL;
+    }
+    if (k == 1) return B[0];
+    if (k == 2) return intersect<map_ops,map_ops>(B[0], B[1], op);
+
+    // the smallest tree gives the pivot, so every split that misses
+    // in any input is cheap and the recursion ends early
+    size_t p = 0, n = 0;
+    for (size_t j = 0; j < k; j++) {
+      n += Seq::size(B[j]);
+      if (Seq::size(B[j]) < Seq::size(B[p])) p = j;
+    }
+    size_t np = Seq::size(B[p]);
+    bool copy = B[p]->ref_cnt > 1;
+    std::vector<node*> L(k), R(k);
+    std::vector<ET> E(k);
+    std::vector<char> found(k, false);
+    split_k(B, k, p, copy, L, R, E, found);
+    bool all = true;
+    for (size_t j = 0; j < k; j++) if (j != p && !found[j]) all = false;
+
+    auto P = utils::fork<node*>(utils::do_parallel(np, n - np),
+      [&] () {return intersect_k(L.data(), k, op);},
+      [&] () {return intersect_k(R.data(), k, op);});
+
+    if (all) {
+      node* r = combine_k(GC::copy_if(B[p], copy, false), p, E, found, op);
+      return Seq::node_join(P.first, P.second, r);
+    } else {
+      GC::dec_if(B[p], copy, false);
+      return Seq::join2(P.first, P.second);
+    }
   }
 
   static node* range_root(node* b, const K& key_left, const K& key_right) {
@@ -265,6 +457,105 @@ struct map_ops : Seq {
     return Seq::node_join(right(r->lc, low), left(r->rc, high), rr);
   }
   
+  // The following traverse the entries with keys in a range in place,
+  // without building the range tree or touching reference counts.
+
+  // map_reduce over entries with key <= e
+  template<class R, class F>
+  static typename R::T map_reduce_left(node* b, const K& e, const F& f,
+				       const R& r, size_t grain) {
+    using T = typename R::T;
+    if (!b) return r.identity();
+    if (Entry::comp(e, get_key(b)))
+      return map_reduce_left<R>(b->lc, e, f, r, grain);
+    auto P = utils::fork<T>(utils::grain_forks(Seq::size(b), grain),
+      [&]() {return Seq::template map_reduce<R>(b->lc, f, r, grain);},
+      [&]() {return map_reduce_left<R>(b->rc, e, f, r, grain);});
+    T v = f(Seq::get_entry(b));
+    return r.add(P.first, r.add(v, P.second));
+  }
+
+  // map_reduce over entries with key >= e
+  template<class R, class F>
+  static typename R::T map_reduce_right(node* b, const K& e, const F& f,
+					const R& r, size_t grain) {
+    using T = typename R::T;
+    if (!b) return r.identity();
+    if (Entry::comp(get_key(b), e))
+      return map_reduce_right<R>(b->rc, e, f, r, grain);
+    auto P = utils::fork<T>(utils::grain_forks(Seq::size(b), grain),
+      [&]() {return map_reduce_right<R>(b->lc, e, f, r, grain);},
+      [&]() {return Seq::template map_reduce<R>(b->rc, f, r, grain);});
+    T v = f(Seq::get_entry(b));
+    return r.add(P.first, r.add(v, P.second));
+  }
+
+  template<class R, class F>
+  static typename R::T map_reduce_range(node* b, const K& low, const K& high,
+					const F& f, const R& r,
+					size_t grain=utils::node_limit) {
+    using T = typename R::T;
+    node* x = range_root(b, low, high);
+    if (!x) return r.identity();
+    auto P = utils::fork<T>(utils::grain_forks(Seq::size(x), grain),
+      [&]() {return map_reduce_right<R>(x->lc, low, f, r, grain);},
+      [&]() {return map_reduce_left<R>(x->rc, high, f, r, grain);});
+    T v = f(Seq::get_entry(x));
+    return r.add(P.first, r.add(v, P.second));
+  }
+
+  // number of entries with key >= e
+  static size_t count_right(node* b, const K& e) {
+    size_t c = 0;
+    while (b) {
+      if (Entry::comp(get_key(b), e)) b = b->rc;
+      else {c += 1 + Seq::size(b->rc); b = b->lc;}
+    }
+    return c;
+  }
+
+  // applies f(entry, start+i) to the i-th entry with key <= e
+  template<class F>
+  static void foreach_left(node* b, const K& e, size_t start, const F& f,
+			   size_t granularity) {
+    if (!b) return;
+    if (Entry::comp(e, get_key(b)))
+      return foreach_left(b->lc, e, start, f, granularity);
+    size_t lsize = Seq::size(b->lc);
+    f(Seq::get_entry(b), start+lsize);
+    utils::fork_no_result(utils::grain_forks(Seq::size(b), granularity),
+      [&] () {Seq::foreach_index(b->lc, start, f, granularity, true);},
+      [&] () {foreach_left(b->rc, e, start+lsize+1, f, granularity);});
+  }
+
+  // applies f(entry, start+i) to the i-th entry with key >= e,
+  // where cnt is the number of such entries
+  template<class F>
+  static void foreach_right(node* b, const K& e, size_t start, size_t cnt,
+			    const F& f, size_t granularity) {
+    if (!b) return;
+    if (Entry::comp(get_key(b), e))
+      return foreach_right(b->rc, e, start, cnt, f, granularity);
+    size_t lcnt = cnt - 1 - Seq::size(b->rc);
+    f(Seq::get_entry(b), start+lcnt);
+    utils::fork_no_result(utils::grain_forks(Seq::size(b), granularity),
+      [&] () {foreach_right(b->lc, e, start, lcnt, f, granularity);},
+      [&] () {Seq::foreach_index(b->rc, start+lcnt+1, f, granularity, true);});
+  }
+
+  // applies f(entry, i) to the i-th entry with key in [low, high]
+  template<class F>
+  static void foreach_range(node* b, const K& low, const K& high, const F& f,
+			    size_t granularity=utils::node_limit) {
+    node* x = range_root(b, low, high);
+    if (!x) return;
+    size_t lcnt = count_right(x->lc, low);
+    f(Seq::get_entry(x), lcnt);
+    utils::fork_no_result(utils::grain_forks(Seq::size(x), granularity),
+      [&] () {foreach_right(x->lc, low, 0, lcnt, f, granularity);},
+      [&] () {foreach_left(x->rc, high, lcnt+1, f, granularity);});
+  }
+
   static node* left_number(node* b, size_t rg) {
 	  if (!b) return NULL;
 	  if (rg == 0) return NULL;
@@ -368,10 +659,10 @@ struct map_ops : Seq {
       node* l = GC::inc_if(b->lc, copy);
       node* r = GC::inc_if(b->rc, copy);
       node* o = GC::copy_if(b, copy, extra_ptr);
-	  ET be = Seq::get_entry(b);
-	  Seq::set_entry(o, e);
-      //combine_values(o, e, false, f);
-	  combine_values(o, be, true, f);
+      // o holds b's entry, whether or not it was copied
+      ET be = std::move(Seq::get_entry(o));
+      Seq::set_entry(o, e);
+      combine_values(o, be, true, f);
       return join(l, r, o);
     }
   }
@@ -382,6 +673,43 @@ struct map_ops : Seq {
     return insert_j(b, e, f, join, extra_ptr);
   }
   
+  // Joins used when the caller owns the tree (e.g. a transient map).
+  // Nodes on the path are reused, and only rebalanced through node_join
+  // when the new children actually violate the balance criteria.
+  static node* owned_join(node* l, node* r, node* m) {
+    m->lc = l; m->rc = r;
+    if (Seq::is_balanced(m)) {
+      Seq::update(m);
+      return m;
+    } else return Seq::node_join(l, r, m);
+  }
+
+  template <class Func>
+  static node* insert_owned(node* b, const ET& e, const Func& f) {
+    auto join = [] (node* l, node* r, node* m) {return owned_join(l,r,m);};
+    return insert_j(b, e, f, join, false);
+  }
+
+  template <class Func>
+  static node* update_owned(node* b, const K& k, const Func& f) {
+    auto join = [] (node* l, node* r, node* m) {return owned_join(l,r,m);};
+    return update_j(b, k, f, join, false);
+  }
+
+  // When b is shared (copy is set) a recursive call returns its input
+  // subtree exactly when it changed nothing.  If neither child changed
+  // and b's entry is kept, b is reused as is, which skips the copy and
+  // the recomputation of its augmented value in node_join.
+  static bool unchanged(node* b, bool copy, node* l, node* r) {
+    return copy && l == b->lc && r == b->rc;}
+
+  // consumes the references held by l and r
+  static node* reuse(node* b, node* l, node* r, bool extra_ptr) {
+    GC::decrement(l);
+    GC::decrement(r);
+    return GC::inc_if(b, extra_ptr);
+  }
+
   template <class Func, class J>
   static node* update_j(node* b, const K& k, const Func& f, const J& join,
 			bool extra_ptr=false){
@@ -391,12 +719,14 @@ struct map_ops : Seq {
     if (Entry::comp(get_key(b), k)) {
       node* l = GC::inc_if(b->lc, copy);
       node* r = update_j(b->rc, k, f, join, copy);
+      if (unchanged(b, copy, l, r)) return reuse(b, l, r, extra_ptr);
       node* o = GC::copy_if(b, copy, extra_ptr);
       return join(l, r, o);
     }
     else if (Entry::comp(k, get_key(b))) {
       node* l = update_j(b->lc, k, f, join, copy);
       node* r = GC::inc_if(b->rc, copy);
+      if (unchanged(b, copy, l, r)) return reuse(b, l, r, extra_ptr);
       node* o = GC::copy_if(b, copy, extra_ptr);
       return join(l, r, o);
     }
@@ -423,11 +753,13 @@ struct map_ops : Seq {
     if (Entry::comp(get_key(b), k)) {
       node* l = GC::inc_if(b->lc, copy);
       node* r = deletet(b->rc, k, copy);
+      if (unchanged(b, copy, l, r)) return reuse(b, l, r, extra_ptr);
       return Seq::node_join(l, r, GC::copy_if(b, copy, extra_ptr));
     }		     
     else if (Entry::comp(k, get_key(b))) {
       node* r = GC::inc_if(b->rc, copy);
       node* l = deletet(b->lc, k, copy);
+      if (unchanged(b, copy, l, r)) return reuse(b, l, r, extra_ptr);
       return Seq::node_join(l, r, GC::copy_if(b, copy, extra_ptr));
     }
     else {
@@ -444,8 +776,9 @@ struct map_ops : Seq {
     if (!b) return Seq::from_array(A,n);
     if (n == 0) return GC::inc_if(b, extra_ptr);
     bool copy = extra_ptr || (b->ref_cnt > 1);
-    K bk = get_key(b);
-    auto less_val = [&] (ET& a) -> bool {return Entry::comp(Entry::get_key(a),bk);};
+    const K& bk = get_key(b);
+    auto less_val = [&] (const ET& a) -> bool {
+      return Entry::comp(Entry::get_key(a),bk);};
     size_t mid = pbbs::binary_search(pbbs::sequence<ET>(A, n), less_val);
     bool dup = (mid < n) && (!Entry::comp(bk, Entry::get_key(A[mid])));
 	  
@@ -458,15 +791,34 @@ struct map_ops : Seq {
     if (dup) combine_values(r, A[mid], false, op);
     return Seq::node_join(P.first, P.second, r);
   }
-  
+
+  // As multi_insert_sorted, but for batches at or near the right end of
+  // b.  The entries of b from A[0] on are merged with a tree built from
+  // A and the result is joined back onto the right spine of the rest,
+  // so only the tail and the spine are touched.  Falls back to
+  // multi_insert_sorted when the tail is larger than the batch.
+  template <class BinaryOp>
+  static node* append_sorted(node* b, ET* A, size_t n, const BinaryOp& op) {
+    if (n == 0) return b;
+    const K& k0 = Entry::get_key(A[0]);
+    size_t tail = Seq::size(b) - rank(b, k0);
+    if (tail == 0) return Seq::join2(b, Seq::from_array(A, n));
+    if (tail > n) return multi_insert_sorted(b, A, n, op);
+    split_info bsts = split(b, k0);
+    node* old = bsts.removed ? Seq::join(NULL, bsts.entry, bsts.second)
+                             : bsts.second;
+    return Seq::join2(bsts.first, uniont(old, Seq::from_array(A, n), op));
+  }
+
   template <class VE, class BinaryOp>
   static node* multi_update_sorted(node* b, std::pair<K, VE>* A, size_t n,
 				   const BinaryOp& op, bool extra_ptr = false) {
     if (!b) return NULL;
     if (n == 0) return GC::inc_if(b, extra_ptr);
     bool copy = extra_ptr || (b->ref_cnt > 1);
-    K bk = get_key(b);
-    auto less_val = [&] (std::pair<K, VE>& a) -> bool {return Entry::comp(a.first,bk);};
+    const K& bk = get_key(b);
+    auto less_val = [&] (const std::pair<K, VE>& a) -> bool {
+      return Entry::comp(a.first,bk);};
     size_t mid = pbbs::binary_search(pbbs::sequence<std::pair<K, VE>>(A, n), less_val);
     bool dup = (mid < n) && (!Entry::comp(bk, A[mid].first));
 	
@@ -475,16 +827,88 @@ struct map_ops : Seq {
 	       [&] () {return multi_update_sorted(b->rc, A+mid+dup,
 						  n-mid-dup, op, copy);});
 
+    if (!dup && unchanged(b, copy, P.first, P.second))
+      return reuse(b, P.first, P.second, extra_ptr);
     node* r = GC::copy_if(b, copy, extra_ptr);
     if (dup) update_valuev(r, A[mid].second, op);
     return Seq::node_join(P.first, P.second, r);
   }
   
+  // assumes array A is of length n and is sorted with no duplicates
+  static node* multi_delete_sorted(node* b, K* A, size_t n,
+				   bool extra_ptr = false) {
+    if (!b) return NULL;
+    if (n == 0) return GC::inc_if(b, extra_ptr);
+    bool copy = extra_ptr || (b->ref_cnt > 1);
+    const K& bk = get_key(b);
+    auto less_val = [&] (const K& a) -> bool {return Entry::comp(a,bk);};
+    size_t mid = pbbs::binary_search(pbbs::sequence<K>(A, n), less_val);
+    bool dup = (mid < n) && (!Entry::comp(bk, A[mid]));
+
+    auto P = utils::fork<node*>(utils::do_parallel(Seq::size(b), n),
+	       [&] () {return multi_delete_sorted(b->lc, A, mid, copy);},
+	       [&] () {return multi_delete_sorted(b->rc, A+mid+dup,
+						  n-mid-dup, copy);});
+
+    if (dup) {
+      GC::dec_if(b, copy, extra_ptr);
+      return Seq::join2(P.first, P.second);
+    }
+    if (unchanged(b, copy, P.first, P.second))
+      return reuse(b, P.first, P.second, extra_ptr);
+    return Seq::node_join(P.first, P.second, GC::copy_if(b, copy, extra_ptr));
+  }
+
+  // A batch of tagged operations for multi_apply_sorted.  An insert
+  // adds the entry or overwrites an existing one, an update combines
+  // the value of an existing key using op(old, new) and is ignored if
+  // the key is absent, and a delete removes the key.
+  enum batch_op : unsigned char {batch_insert, batch_update, batch_delete};
+  using tagged_op = std::pair<ET, batch_op>;
+
+  // assumes array A is of length n and is sorted by key with no duplicates
+  template <class BinaryOp>
+  static node* multi_apply_sorted(node* b, tagged_op* A, size_t n,
+				  const BinaryOp& op, bool extra_ptr = false) {
+    if (n == 0) return GC::inc_if(b, extra_ptr);
+    if (!b) {
+      auto is_insert = [&] (size_t i) {return A[i].second == batch_insert;};
+      auto get_entry = [&] (size_t i) {return A[i].first;};
+      pbbs::sequence<ET> B = pbbs::pack(pbbs::dseq(n, get_entry),
+					pbbs::dseq(n, is_insert));
+      return Seq::from_array(B.begin(), B.size());
+    }
+    bool copy = extra_ptr || (b->ref_cnt > 1);
+    const K& bk = get_key(b);
+    auto less_val = [&] (const tagged_op& a) -> bool {
+      return Entry::comp(Entry::get_key(a.first),bk);};
+    size_t mid = pbbs::binary_search(pbbs::sequence<tagged_op>(A, n), less_val);
+    bool dup = (mid < n) && (!Entry::comp(bk, Entry::get_key(A[mid].first)));
+
+    auto P = utils::fork<node*>(utils::do_parallel(Seq::size(b), n),
+	       [&] () {return multi_apply_sorted(b->lc, A, mid, op, copy);},
+	       [&] () {return multi_apply_sorted(b->rc, A+mid+dup,
+						 n-mid-dup, op, copy);});
+
+    if (dup && A[mid].second == batch_delete) {
+      GC::dec_if(b, copy, extra_ptr);
+      return Seq::join2(P.first, P.second);
+    }
+    if (!dup && unchanged(b, copy, P.first, P.second))
+      return reuse(b, P.first, P.second, extra_ptr);
+    node* r = GC::copy_if(b, copy, extra_ptr);
+    if (dup) {
+      if (A[mid].second == batch_insert) Seq::set_entry(r, A[mid].first);
+      else combine_values(r, A[mid].first, false, op);
+    }
+    return Seq::node_join(P.first, P.second, r);
+  }
+
   static bool multi_find_sorted(node* b, K* A, size_t n, V* ret, size_t offset) {
     if (!b) return true;
     if (n == 0) return true;
-    K bk = get_key(b);
-    auto less_val = [&] (K a) -> bool {return Entry::comp(a,bk);};
+    const K& bk = get_key(b);
+    auto less_val = [&] (const K& a) -> bool {return Entry::comp(a,bk);};
     size_t mid = pbbs::binary_search(pbbs::sequence<K>(A, n), less_val);
     bool dup = (mid < n) && (!Entry::comp(bk, A[mid]));
     utils::fork<bool>(utils::do_parallel(Seq::size(b), n),
@@ -495,7 +919,50 @@ struct map_ops : Seq {
     if (dup) ret[offset+mid] = get_val(b);
 	return true;
   }
-  
+
+  // Batched lookup over A[0,n), sorted by key with get_k(A[i]).
+  // Calls out(offset+i, r) exactly once for each i, where r is an
+  // empty maybe if the key is absent.  When the left recursion is only
+  // a query or two, the right child is prefetched while it runs; after
+  // a longer one the line would be gone by the time it is used.
+  template <class T, class GetKey, class Out>
+  static void multi_find_f(node* b, T* A, size_t n, size_t offset,
+			   const GetKey& get_k, const Out& out) {
+    if (n == 0) return;
+    if (!b) {
+      for (size_t i = 0; i < n; i++) out(offset+i, maybe<V>());
+      return;
+    }
+    const K& bk = get_key(b);
+    auto less_val = [&] (const T& a) -> bool {return Entry::comp(get_k(a),bk);};
+    size_t mid = pbbs::binary_search(pbbs::sequence<T>(A, n), less_val);
+    size_t hi = mid;  // A may contain repeated keys
+    while (hi < n && !Entry::comp(bk, get_k(A[hi]))) hi++;
+    size_t rn = n-hi;
+    if (mid > 0 && mid <= 2 && rn > 0) __builtin_prefetch(b->rc);
+    utils::fork_no_result(utils::do_parallel(Seq::size(b), n),
+	  [&] () {multi_find_f(b->lc, A, mid, offset, get_k, out);},
+	  [&] () {multi_find_f(b->rc, A+hi, rn, offset+hi, get_k, out);});
+    for (size_t i = mid; i < hi; i++) out(offset+i, maybe<V>(get_val(b)));
+  }
+
+  // keys in A are sorted, ret[i] gets the result for A[i]
+  static void multi_find_sorted(node* b, K* A, size_t n, maybe<V>* ret) {
+    auto get_k = [] (const K& a) -> const K& {return a;};
+    auto out = [&] (size_t i, maybe<V> r) {ret[i] = r;};
+    multi_find_f(b, A, n, 0, get_k, out);
+  }
+
+  // A holds (key, query index) pairs sorted by key,
+  // ret[A[i].second] gets the result for A[i].first
+  static void multi_find_indexed(node* b, std::pair<K,size_t>* A, size_t n,
+				 maybe<V>* ret) {
+    auto get_k = [] (const std::pair<K,size_t>& a) -> const K& {
+      return a.first;};
+    auto out = [&] (size_t i, maybe<V> r) {ret[A[i].second] = r;};
+    multi_find_f(b, A, n, 0, get_k, out);
+  }
+
   template<class InTree, class Func>
   static node* map(typename InTree::node* b, const Func& f) {
     auto g = [&] (typename InTree::ET& a) {
@@ -508,6 +975,29 @@ struct map_ops : Seq {
     return Seq::template map<InTree>(b, f);
   }
 
+  // the consuming versions of map, map_set and map_filter, for inputs
+  // of the same type as the output.  They reuse the unshared nodes.
+  template<class Func>
+  static node* map_inplace(node* b, const Func& f) {
+    auto g = [&] (ET& a) {return ET(Entry::get_key(a), f(a));};
+    return Seq::map_inplace(b, g);
+  }
+
+  template<class Func>
+  static node* map_set_inplace(node* b, const Func& f) {
+    return Seq::map_inplace(b, f);
+  }
+
+  template<class Func>
+  static node* map_filter_inplace(node* b, const Func& f) {
+    auto g = [&] (ET& a) {
+      maybe<V> v = f(a);
+      if (v) return maybe<ET>(ET(Entry::get_key(a), *v));
+      else return maybe<ET>();
+    };
+    return Seq::map_filter_inplace(b, g);
+  }
+
   template<class Seq1, class Func>
     static node* map_filter(typename Seq1::node* b, const Func& f,
 			    size_t granularity=utils::node_limit) {
@@ -0,0 +1,110 @@
+#pragma once
+#include <vector>
+#include "map_iterator.h"
+
+// *******************************************
+//   MERGE JOIN
+//   A cursor over the keys present in all of k maps, in key order,
+//   without building a result tree.  It is a leapfrog join: the
+//   iterator at the smallest key is moved straight to the current
+//   largest key with a seek, so a run of non-matching keys costs
+//   O(log n) however long it is.  Like the iterators it is built
+//   on, it neither allocates per step nor changes reference counts,
+//   and the maps must outlive it.
+// *******************************************
+
+template <class M>
+class merge_join {
+public:
+  using iterator = typename M::iterator;
+  using Entry = typename M::Entry;
+  using K = typename Entry::key_t;
+  using E = typename Entry::entry_t;
+
+  // joins the maps
+  merge_join(std::vector<const M*> maps)
+    : merge_join(std::move(maps), NULL, NULL) {}
+
+  // restricted to keys >= *lo if lo is not null, and < *hi if hi is not
+  merge_join(std::vector<const M*> maps, const K* lo, const K* hi)
+    : maps(std::move(maps)), bounded(hi != NULL) {
+    if (bounded) this->hi = *hi;
+    for (const M* m : this->maps)
+      its.push_back(lo ? iterator::seek(m->root, *lo) : m->begin());
+    finished = its.size() == 0;
+    align();
+  }
+
+  bool done() const { return finished; }
+
+  // the current key, and its entry in the j-th map
+  const K& key() const { return Entry::get_key(*its[0]); }
+  const E& entry(size_t j) const { return *its[j]; }
+  size_t num_maps() const { return its.size(); }
+
+  void next() {
+    ++its[0];
+    align();
+  }
+
+private:
+  std::vector<const M*> maps;
+  std::vector<iterator> its;
+  bool finished;
+  bool bounded;
+  K hi;
+
+  const K& key_of(size_t j) const { return Entry::get_key(*its[j]); }
+
+  // moves the iterators forward to the next key present in every map
+  void align() {
+    size_t k = its.size();
+    while (!finished) {
+      for (size_t j = 0; j < k; j++)
+	if (its[j].is_end()) {finished = true; return;}
+      size_t top = 0;
+      for (size_t j = 1; j < k; j++)
+	if (Entry::comp(key_of(top), key_of(j))) top = j;
+      if (bounded && !Entry::comp(key_of(top), hi)) {finished = true; return;}
+      bool all = true;
+      for (size_t j = 0; j < k && !finished; j++) {
+	if (Entry::comp(key_of(j), key_of(top))) {
+	  its[j] = iterator::seek(maps[j]->root, key_of(top));
+	  if (its[j].is_end()) finished = true;
+	  else if (Entry::comp(key_of(top), key_of(j))) all = false;
+	}
+      }
+      if (all) return;
+    }
+  }
+};
+
+// Calls f(cursor) for every key present in all the maps, in key order.
+template <class M, class F>
+void merge_join_foreach(std::vector<const M*> maps, const F& f) {
+  for (merge_join<M> c(std::move(maps)); !c.done(); c.next()) f(c);
+}
+
+// As merge_join_foreach, but the key space is split by rank in the
+// largest map into blocks that are joined in parallel.  f is called in
+// key order within a block, and the blocks are processed in parallel.
+template <class M, class F>
+void merge_join_foreach_par(std::vector<const M*> maps, const F& f,
+			    size_t block_size = (1 << 12)) {
+  using K = typename M::Entry::key_t;
+  if (maps.size() == 0) return;
+  const M* big = maps[0];
+  for (const M* m : maps) if (m->size() > big->size()) big = m;
+  size_t n = big->size();
+  size_t blocks = std::min<size_t>(n / block_size + 1, 1024);
+  if (blocks == 1) {merge_join_foreach(maps, f); return;}
+  // block i covers keys in [bounds[i-1], bounds[i])
+  std::vector<K> bounds(blocks - 1);
+  for (size_t i = 1; i < blocks; i++)
+    bounds[i-1] = M::Entry::get_key(*big->select(i * n / blocks));
+  parallel_for(0, blocks, [&] (size_t i) {
+    const K* lo = (i == 0) ? NULL : &bounds[i-1];
+    const K* hi = (i + 1 == blocks) ? NULL : &bounds[i];
+    for (merge_join<M> c(maps, lo, hi); !c.done(); c.next()) f(c);
+  });
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// *******************************************
+//   NUMA TOPOLOGY AND PLACEMENT
+//   The topology is read once from /sys/devices/system/node, so no
+//   libnuma is needed.  Memory is placed with the mbind system call
+//   before it is first touched.  On machines with a single node (or
+//   where mbind is not permitted) placement is a no-op and the memory
+//   falls back to first touch.
+// *******************************************
+
+namespace numa {
+
+  // from linux/mempolicy.h
+  constexpr int mpol_preferred = 1;
+  constexpr int mpol_interleave = 3;
+
+  // nodes beyond this are treated as node 0
+  constexpr int max_nodes = 64;
+
+  struct topology {
+    int num_nodes = 1;
+    std::vector<int> cpu_node;  // node of each cpu
+  };
+
+  // parses a cpulist such as "0-3,8-11" and assigns its cpus to node
+  inline void add_cpus(topology& t, const std::string& s, int node) {
+    size_t i = 0;
+    while (i < s.size()) {
+      size_t j = s.find(',', i);
+      if (j == std::string::npos) j = s.size();
+      std::string r = s.substr(i, j - i);
+      size_t d = r.find('-');
+      if (r.size() > 0) {
+	int lo = std::stoi(r.substr(0, d));
+	int hi = (d == std::string::npos) ? lo : std::stoi(r.substr(d+1));
+	if ((int) t.cpu_node.size() <= hi) t.cpu_node.resize(hi+1, 0);
+	for (int c = lo; c <= hi; c++) t.cpu_node[c] = node;
+      }
+      i = j + 1;
+    }
+  }
+
+  inline topology read_topology() {
+    topology t;
+    int n = 0;
+    while (n < max_nodes) {
+      std::ifstream f("/sys/devices/system/node/node" + std::to_string(n)
+		      + "/cpulist");
+      if (!f) break;
+      std::string s;
+      std::getline(f, s);
+      add_cpus(t, s, n++);
+    }
+    t.num_nodes = std::max(n, 1);
+    return t;
+  }
+
+  inline topology& get_topology() {
+    static topology t = read_topology();
+    return t;
+  }
+
+  inline int num_nodes() { return get_topology().num_nodes; }
+
+  // the node of the cpu the calling thread is running on
+  inline int current_node() {
+    topology& t = get_topology();
+    int c = sched_getcpu();
+    if (c < 0 || c >= (int) t.cpu_node.size()) return 0;
+    return t.cpu_node[c];
+  }
+
+  inline void bind(void* p, size_t len, int mode, unsigned long mask) {
+#ifdef SYS_mbind
+    syscall(SYS_mbind, p, len, mode, &mask, (unsigned long) max_nodes + 1, 0);
+#endif
+  }
+
+  // prefer the node of the calling thread for the pages in [p, p+len)
+  inline void place_local(void* p, size_t len) {
+    if (num_nodes() > 1)
+      bind(p, len, mpol_preferred, 1ul << current_node());
+  }
+
+  // interleave the pages in [p, p+len) across all nodes
+  inline void place_interleaved(void* p, size_t len) {
+    int n = num_nodes();
+    if (n > 1)
+      bind(p, len, mpol_interleave,
+	   (n >= max_nodes) ? ~0ul : (1ul << n) - 1);
+  }
+
+  // while set, numa_allocator places new nodes in interleaved memory
+  inline bool& interleaving() {
+    static thread_local bool b = false;
+    return b;
+  }
+
+  // RAII, may nest
+  struct interleave_guard {
+    bool old;
+    interleave_guard() : old(interleaving()) { interleaving() = true; }
+    ~interleave_guard() { interleaving() = old; }
+    interleave_guard(const interleave_guard&) = delete;
+    interleave_guard& operator = (const interleave_guard&) = delete;
+  };
+}
@@ -3,7 +3,11 @@
 #include "pbbslib/utilities.h"
 #include "basic_node.h"
 #include "augmented_node.h"
+#include "lazy_augmented_node.h"
+#include "sparse_augmented_node.h"
+#include "tagged_augmented_node.h"
 #include "utils.h"
+#include "granularity.h"
 #include "gc.h"
 #include "avl_tree.h"
 #include "red_black_tree.h"
@@ -13,6 +17,13 @@
 #include "map_ops.h"
 #include "augmented_ops.h"
 #include "build.h"
+#include "map_iterator.h"
+#include "blocked_ops.h"
 #include "map.h"
 #include "augmented_map.h"
+#include "transient_map.h"
+#include "snapshot_view.h"
+#include "merge_join.h"
+#include "tagged_map.h"
+#include "blocked_map.h"
 
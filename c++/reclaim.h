@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+
+// *******************************************
+//   BACKGROUND RECLAMATION
+//   An optional service that frees dropped tree versions off the
+//   critical path.  While it is running, gc::drop hands roots whose
+//   last reference is being dropped to a lock-free stack, and a pool
+//   of background threads frees them.  Large trees are split so that
+//   several workers can free one tree in parallel.
+//   The workers are plain std::threads, so only trees whose node
+//   allocator accepts frees from threads outside the scheduler (it has
+//   frees_anywhere = true, as the block_pool policies in allocators.h
+//   do) use the service.  Other trees are freed inline as before.
+// *******************************************
+
+namespace reclaim {
+
+  // does the allocator policy Alloc accept frees from any thread
+  template <class Alloc, class = void>
+  struct frees_anywhere : std::false_type {};
+
+  template <class Alloc>
+  struct frees_anywhere<Alloc, std::void_t<decltype(Alloc::frees_anywhere)>>
+    : std::integral_constant<bool, Alloc::frees_anywhere> {};
+
+  struct job {
+    void* p;
+    void (*free_f)(void*);
+    job* next;
+  };
+
+  struct service {
+    std::atomic<job*> head{nullptr};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> enqueued{0};
+    std::atomic<size_t> completed{0};
+    std::vector<std::thread> workers;
+    std::mutex lock;  // only for sleeping and waking the workers
+    std::condition_variable wake;
+  };
+
+  inline service& get_service() {
+    static service s;
+    return s;
+  }
+
+  inline bool running() { return get_service().running.load(); }
+
+  // Treiber stack push
+  inline void enqueue(void* p, void (*free_f)(void*)) {
+    service& s = get_service();
+    job* j = new job{p, free_f, s.head.load()};
+    s.enqueued.fetch_add(1);
+    while (!s.head.compare_exchange_weak(j->next, j)) {}
+    // workers only sleep on an empty stack and take all of it, so only
+    // a push onto an empty stack needs to wake one.  A worker that found
+    // it empty is either waiting, or holds the lock and will see j
+    // before it waits.
+    if (j->next == nullptr) {
+      { std::lock_guard<std::mutex> g(s.lock); }
+      s.wake.notify_one();
+    }
+  }
+
+  // workers take the whole stack at once, which avoids ABA on pop
+  inline void worker_loop() {
+    service& s = get_service();
+    while (true) {
+      job* j = s.head.exchange(nullptr);
+      if (!j) {
+	std::unique_lock<std::mutex> g(s.lock);
+	s.wake.wait(g, [&] {return s.head.load() || s.stopping.load();});
+	if (!s.head.load()) return;
+	continue;
+      }
+      while (j) {
+	job* next = j->next;
+	j->free_f(j->p);
+	delete j;
+	s.completed.fetch_add(1);
+	j = next;
+      }
+    }
+  }
+
+  // starts the service with the given number of background threads
+  inline void start(size_t num_threads = 1) {
+    service& s = get_service();
+    if (s.running.load()) return;
+    s.stopping = false;
+    for (size_t i = 0; i < num_threads; i++)
+      s.workers.push_back(std::thread(worker_loop));
+    s.running = true;
+  }
+
+  // number of jobs queued but not yet freed
+  inline size_t pending() {
+    service& s = get_service();
+    return s.enqueued.load() - s.completed.load();
+  }
+
+  inline size_t num_enqueued() { return get_service().enqueued.load(); }
+  inline size_t num_completed() { return get_service().completed.load(); }
+
+  // blocks until everything queued so far has been freed
+  inline void drain() {
+    while (pending() > 0) std::this_thread::yield();
+  }
+
+  // drains the queue and stops the background threads
+  inline void stop() {
+    service& s = get_service();
+    if (!s.running.load()) return;
+    s.running = false;
+    drain();
+    {
+      std::lock_guard<std::mutex> g(s.lock);
+      s.stopping = true;
+    }
+    s.wake.notify_all();
+    for (std::thread& t : s.workers) t.join();
+    s.workers.clear();
+    worker_loop();  // anything that raced with stopping
+  }
+}
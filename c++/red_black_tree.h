@@ -36,8 +36,9 @@ struct red_black_tree {
       t->height = height(t->lc) + (t->color == BLACK);
     }
     
-    static node* single(ET e) {
-      node *o = Node::single(e);
+    template <class T>
+    static node* single(T&& e) {
+      node *o = Node::single(std::forward<T>(e));
       o->height = 1;
       o->color = BLACK;
       return o;
@@ -100,7 +101,7 @@ struct red_black_tree {
       if (height(t1) == height(t2) && color(t2) == BLACK) 
 	return balanced_join(t1, t2, k, RED);
       node* t = GC::copy_if_needed(t2);
-      t->lc = right_join(t1, t->lc, k);
+      t->lc = left_join(t1, t->lc, k);
 
       // rebalance if needed
       if (t->color == BLACK && color(t->lc) == RED && color(t->lc->lc) == RED) {
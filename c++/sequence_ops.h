@@ -1,6 +1,7 @@
 #pragma once
 #include "gc.h"
 #include "utils.h"
+#include "granularity.h"
 
 // *******************************************
 //   SEQUENCES
@@ -12,11 +13,25 @@ struct sequence_ops : Tree {
   using ET = typename Tree::ET;
   using GC = gc<Tree>;
 
-  static node* join(node* l, ET e, node* r) {
+  static node* join(node* l, const ET& e, node* r) {
     node *x = Tree::make_node(e);
     return Tree::node_join(l, r, x);
   }
   
+  // copies the top levels of a (consuming), sharing everything below.
+  // The copies are allocated by the calling thread, so they can be
+  // placed differently from the rest of the tree.
+  static node* copy_top(node* a, size_t levels) {
+    if (a == NULL || levels == 0) return a;
+    GC::increment(a->lc);
+    GC::increment(a->rc);
+    node* l = copy_top(a->lc, levels - 1);
+    node* r = copy_top(a->rc, levels - 1);
+    node* o = Tree::make_node(Tree::get_entry(a));
+    GC::decrement_recursive(a);
+    return Tree::node_join(l, r, o);
+  }
+
   static node_size_t depth(node* a) {
     if (a == NULL) return 0;
     auto P = utils::fork<node_size_t>(Tree::size(a) >= utils::node_limit,
@@ -83,11 +98,28 @@ struct sequence_ops : Tree {
     //return r;
   }
 
+  // as map, but consumes b, which has the same node type as the result.
+  // Nodes that are not shared get the new entry in place, and only the
+  // shared ones are copied.
+  template<class Func>
+  static node* map_inplace(node* b, const Func& f, bool extra_ptr = false) {
+    if (!b) return NULL;
+    bool copy = extra_ptr || (b->ref_cnt > 1);
+    auto P = utils::fork<node*>(Tree::size(b) >= utils::node_limit,
+       [&] () {return map_inplace(b->lc, f, copy);},
+       [&] () {return map_inplace(b->rc, f, copy);});
+    ET e = f(Tree::get_entry(b));
+    node* o = GC::copy_if(b, e, copy, extra_ptr);
+    if (!copy) Tree::set_entry(o, std::move(e));
+    return Tree::node_join(P.first, P.second, o);
+  }
+
   template<typename F>
   static void foreach_index(node* a, size_t start, const F& f,
 			    size_t granularity=utils::node_limit,
 			    bool extra_ptr = false) {
-
+    if (granularity == utils::auto_grain)
+      return foreach_index_auto(a, start, f, extra_ptr);
     if (!a) return;
     bool copy = extra_ptr || (a->ref_cnt > 1);
     size_t lsize = Tree::size(a->lc);
@@ -97,6 +129,23 @@ struct sequence_ops : Tree {
       [&] () {foreach_index(a->rc, start + lsize + 1,f, granularity, copy);});
     if (!extra_ptr) GC::decrement(a);
   }
+
+  // foreach_index with the cutoff picked by a grain_control
+  template<typename F>
+  static void foreach_index_auto(node* a, size_t start, const F& f,
+				 bool extra_ptr) {
+    auto seq = [&] () {foreach_index(a, start, f, utils::no_fork, extra_ptr);};
+    utils::grain_control& g = utils::grain_for<decltype(seq)>;
+    size_t n = Tree::size(a);
+    if (n < g.cutoff()) return g.leaf(n, seq);
+    bool copy = extra_ptr || (a->ref_cnt > 1);
+    size_t lsize = Tree::size(a->lc);
+    f(Tree::get_entry(a), start+lsize);
+    utils::fork_no_result(true,
+      [&] () {foreach_index_auto(a->lc, start, f, copy);},
+      [&] () {foreach_index_auto(a->rc, start + lsize + 1, f, copy);});
+    if (!extra_ptr) GC::decrement(a);
+  }
   
   // similar to above but sequential using in-order traversal
   // usefull if using 20th century constructs such as iterators
@@ -110,6 +159,7 @@ struct sequence_ops : Tree {
 
   template<class Func>
   static node* filter(node* b, const Func& f, size_t granularity=utils::node_limit, bool extra_ptr = false) {
+    if (granularity == utils::auto_grain) return filter_auto(b, f, extra_ptr);
     if (!b) return NULL;
     bool copy = extra_ptr || (b->ref_cnt > 1);
     
@@ -124,20 +174,72 @@ struct sequence_ops : Tree {
       return join2(P.first, P.second);
     }
   }
+
+  // filter with the cutoff picked by a grain_control
+  template<class Func>
+  static node* filter_auto(node* b, const Func& f, bool extra_ptr) {
+    auto seq = [&] () {return filter(b, f, utils::no_fork, extra_ptr);};
+    utils::grain_control& g = utils::grain_for<decltype(seq)>;
+    size_t n = Tree::size(b);
+    if (n < g.cutoff()) return g.leaf(n, seq);
+    bool copy = extra_ptr || (b->ref_cnt > 1);
+
+    auto P = utils::fork<node*>(true,
+      [&]() {return filter_auto(b->lc, f, copy);},
+      [&]() {return filter_auto(b->rc, f, copy);});
+
+    if (f(Tree::get_entry(b))) {
+      return Tree::node_join(P.first, P.second, GC::copy_if(b, copy, extra_ptr));
+    } else {
+      GC::dec_if(b, copy, extra_ptr);
+      return join2(P.first, P.second);
+    }
+  }
   
+  // some node of b whose entry satisfies f, or NULL.  Stops when c is
+  // cancelled, and cancels it when it finds one.  Does not consume b.
+  template<class Func>
+  static node* find_if(node* b, const Func& f, utils::cancel_token& c) {
+    if (!b || c.cancelled()) return NULL;
+    if (f(Tree::get_entry(b))) {c.cancel(); return b;}
+    auto P = utils::fork<node*>(Tree::size(b) >= utils::node_limit,
+      [&]() {return find_if(b->lc, f, c);},
+      [&]() {return find_if(b->rc, f, c);});
+    return P.first ? P.first : P.second;
+  }
+
+  template<class Func>
+  static bool any_of(node* b, const Func& f) {
+    utils::cancel_token c;
+    return find_if(b, f, c) != NULL;
+  }
+
+  // the first node of b in order whose entry satisfies f, or NULL.
+  // start is the rank of the first entry of b, and best the smallest
+  // rank matched so far, so subtrees entirely after a match are
+  // skipped.  Does not consume b.
   template<class Func>
-  static bool if_exist(node* b, const Func& f, bool* indicator) {
-    if (!b) return false;
-	if (*indicator) return true;
-	if (f(Tree::get_entry(b))) {
-		*indicator = true;
-		return true;
+  static node* first_match(node* b, const Func& f, size_t start,
+			   std::atomic<size_t>& best) {
+    if (!b || start >= best.load(std::memory_order_relaxed)) return NULL;
+    size_t rank = start + Tree::size(b->lc);
+    auto P = utils::fork<node*>(Tree::size(b) >= utils::node_limit,
+      [&]() {return first_match(b->lc, f, start, best);},
+      [&]() -> node* {
+	if (rank < best.load(std::memory_order_relaxed) &&
+	    f(Tree::get_entry(b))) {
+	  size_t o = best.load();
+	  while (rank < o && !best.compare_exchange_weak(o, rank));
+	  return b;
 	}
-    
-    auto P = utils::fork<bool>(Tree::size(b) >= utils::node_limit,
-      [&]() {return if_exist(b->lc, f, indicator);},
-      [&]() {return if_exist(b->rc, f, indicator);});
-	return P.first || P.second;
+	return first_match(b->rc, f, rank + 1, best);});
+    return P.first ? P.first : P.second;
+  }
+
+  template<class Func>
+  static node* first_match(node* b, const Func& f) {
+    std::atomic<size_t> best(Tree::size(b));
+    return first_match(b, f, 0, best);
   }
   
   // Assumes the input is sorted and there are no duplicate keys
@@ -158,6 +260,7 @@ struct sequence_ops : Tree {
   template<class Seq1, class Func>
   static node* map_filter(typename Seq1::node* b, const Func& f,
 			  size_t granularity=utils::node_limit) {
+    if (granularity == utils::auto_grain) return map_filter_auto<Seq1>(b, f);
     if (!b) return NULL;
     
     auto P = utils::fork<node*>(Seq1::size(b) >= granularity,
@@ -171,10 +274,51 @@ struct sequence_ops : Tree {
     } else return join2(P.first, P.second);
   }
 
+  // as map_filter, but consumes b, reusing its nodes that are not shared
+  template<class Func>
+  static node* map_filter_inplace(node* b, const Func& f,
+				  bool extra_ptr = false) {
+    if (!b) return NULL;
+    bool copy = extra_ptr || (b->ref_cnt > 1);
+    auto P = utils::fork<node*>(Tree::size(b) >= utils::node_limit,
+      [&]() {return map_filter_inplace(b->lc, f, copy);},
+      [&]() {return map_filter_inplace(b->rc, f, copy);});
+
+    maybe<ET> me = f(Tree::get_entry(b));
+    if (me) {
+      node* o = GC::copy_if(b, *me, copy, extra_ptr);
+      if (!copy) Tree::set_entry(o, std::move(*me));
+      return Tree::node_join(P.first, P.second, o);
+    } else {
+      GC::dec_if(b, copy, extra_ptr);
+      return join2(P.first, P.second);
+    }
+  }
+
+  // map_filter with the cutoff picked by a grain_control
+  template<class Seq1, class Func>
+  static node* map_filter_auto(typename Seq1::node* b, const Func& f) {
+    auto seq = [&] () {return map_filter<Seq1>(b, f, utils::no_fork);};
+    utils::grain_control& g = utils::grain_for<decltype(seq)>;
+    size_t n = Seq1::size(b);
+    if (n < g.cutoff()) return g.leaf(n, seq);
+
+    auto P = utils::fork<node*>(true,
+      [&]() {return map_filter_auto<Seq1>(b->lc, f);},
+      [&]() {return map_filter_auto<Seq1>(b->rc, f);});
+
+    maybe<ET> me = f(Seq1::get_entry(b));
+    if (me) {
+      node* r = Tree::make_node(*me);
+      return Tree::node_join(P.first, P.second, r);
+    } else return join2(P.first, P.second);
+  }
+
   template<class R, class F>
   static typename R::T map_reduce(node* b, F f, R r,
 				  size_t grain=utils::node_limit) {
     using T = typename R::T;
+    if (grain == utils::auto_grain) return map_reduce_auto<R>(b, f, r);
     if (!b) return r.identity();
     
     auto P = utils::fork<T>(Tree::size(b) >= grain,
@@ -185,6 +329,23 @@ struct sequence_ops : Tree {
     return R::add(P.first, r.add(v, P.second));
   }
 
+  // map_reduce with the cutoff picked by a grain_control
+  template<class R, class F>
+  static typename R::T map_reduce_auto(node* b, F& f, R& r) {
+    using T = typename R::T;
+    auto seq = [&] () {return map_reduce<R>(b, f, r, utils::no_fork);};
+    utils::grain_control& g = utils::grain_for<decltype(seq)>;
+    size_t n = Tree::size(b);
+    if (n < g.cutoff()) return g.leaf(n, seq);
+
+    auto P = utils::fork<T>(true,
+      [&]() {return map_reduce_auto<R>(b->lc, f, r);},
+      [&]() {return map_reduce_auto<R>(b->rc, f, r);});
+
+    T v = f(Tree::get_entry(b));
+    return R::add(P.first, r.add(v, P.second));
+  }
+
   // template<class T, class Map, class Reduce>
   // static T map_reduce_index(node* a, Map m, Reduce r, T identity,
   // 			    size_t start, size_t grain=utils::node_limit) {
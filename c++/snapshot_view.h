@@ -0,0 +1,143 @@
+#pragma once
+
+using namespace std;
+
+// *******************************************
+//   SNAPSHOT VIEWS
+//   A read-only view of the current version of a snapshot_map that is
+//   kept alive by pinning an epoch (see epoch.h) instead of incrementing
+//   the root's reference count, so many readers of the same version do
+//   not contend on its cache line.
+//   Views are opt-in per map: only a snapshot_map can hand them out,
+//   and its writer replaces versions by publishing a new root and
+//   retiring the old one, which is freed once no pinned reader can see
+//   it.  Ordinary maps, and updates of them, are unaffected.
+//   A view is tied to the thread that created it and cannot be copied.
+// *******************************************
+
+template <class Map> class snapshot_map;
+
+template <class Map>
+class snapshot_view {
+public:
+  using M = Map;
+  using Tree = typename M::Tree;
+  using GC = typename M::GC;
+  using Entry = typename M::Entry;
+  using node = typename M::node;
+  using E = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+  using maybe_V = maybe<V>;
+
+  explicit snapshot_view(const snapshot_map<M>& m) {
+    epoch::pin();
+    root = __atomic_load_n(&m.root, __ATOMIC_SEQ_CST);
+  }
+
+  ~snapshot_view() { epoch::unpin(); }
+
+  snapshot_view(const snapshot_view&) = delete;
+  snapshot_view& operator = (const snapshot_view&) = delete;
+
+  size_t size() const { return Tree::size(root); }
+  bool is_empty() const { return root == NULL; }
+
+  maybe_V find(const K& key) const {
+    node* a = Tree::find(root, key);
+    if (a != NULL) return maybe_V(Entry::get_val(Tree::get_entry(a)));
+    else return maybe_V();
+  }
+
+  bool contains(const K& key) const {
+    return Tree::find(root, key) != NULL;}
+
+  template<class R, class F>
+  typename R::T map_reduce(const F& f, const R& r,
+			   size_t grain=utils::node_limit) const {
+    return Tree::template map_reduce<R>(root, f, r, grain);}
+
+  template<class R, class F>
+  typename R::T map_reduce_range(const K& kl, const K& kr, const F& f,
+				 const R& r,
+				 size_t grain=utils::node_limit) const {
+    return Tree::template map_reduce_range<R>(root, kl, kr, f, r, grain);}
+
+  template <class F>
+  void foreach_seq(const F& f) const { Tree::foreach_seq(root, f); }
+
+  template <class F>
+  void foreach_index(const F& f, size_t start=0,
+		     size_t granularity=utils::node_limit) const {
+    Tree::foreach_index(root, start, f, granularity, true);}
+
+  // augmented queries, only for views of aug_maps
+  auto aug_val() const { return Tree::aug_val(root); }
+
+  auto aug_left(const K& key) const {
+    typename Tree::aug_sum_t a;
+    Tree::aug_sum_left(root, key, a);
+    return a.result;}
+
+  auto aug_right(const K& key) const {
+    typename Tree::aug_sum_t a;
+    Tree::aug_sum_right(root, key, a);
+    return a.result;}
+
+  auto aug_range(const K& key_left, const K& key_right) const {
+    return Tree::aug_range(root, key_left, key_right);}
+
+  // a counted (ordinary) copy of the viewed version
+  M to_map() const {
+    GC::increment(root);
+    return M(root);
+  }
+
+private:
+  node* root;
+};
+
+// A map that readers on other threads view through snapshot_views.
+// It has a single writer.  The writer reads the current version with
+// current(), which is counted so that updates of it copy the paths they
+// change, and installs new versions with publish or update.
+template <class Map>
+class snapshot_map {
+public:
+  using M = Map;
+  using GC = typename M::GC;
+  using node = typename M::node;
+
+  snapshot_map() : root(NULL) {}
+  explicit snapshot_map(M m) : root(m.root) { m.root = NULL; }
+  ~snapshot_map() { GC::retire(root); }
+
+  snapshot_map(const snapshot_map&) = delete;
+  snapshot_map& operator = (const snapshot_map&) = delete;
+
+  // epoch-pinned read-only view of the current version
+  snapshot_view<M> snapshot() const { return snapshot_view<M>(*this); }
+
+  // a counted copy of the current version, for the writer only
+  M current() const {
+    GC::increment(root);
+    return M(root);
+  }
+
+  // makes m the current version.  The old one is freed once no view
+  // can see it.
+  void publish(M m) {
+    node* old = root;
+    __atomic_store_n(&root, m.root, __ATOMIC_SEQ_CST);
+    m.root = NULL;
+    GC::retire(old);
+  }
+
+  // publishes f(current())
+  template <class F>
+  void update(const F& f) { publish(f(current())); }
+
+private:
+  friend class snapshot_view<M>;
+  node* root;
+};
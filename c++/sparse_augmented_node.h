@@ -0,0 +1,91 @@
+#pragma once
+#include "augmented_node.h"
+
+// *******************************************
+//   SPARSE AUGMENTED NODE
+// *******************************************
+
+// An augmented node that only stores the augmented value of subtrees
+// with at least threshold entries, on the heap.  Smaller subtrees hold
+// a null pointer, and their value is recomputed by a sequential scan
+// when a query (aug_sum_left, aug_range, aug_filter, ...) needs it, at
+// a cost of O(threshold) combines.  When aug_t is large this saves
+// most of the memory an aug_node spends on augmented values, since
+// most nodes of a tree are in small subtrees.
+// The Entry interface is the same as for aug_node.
+
+template <class ET, class AT>
+struct sparse_aug_entry {
+  ET first;
+  AT* second;
+
+  sparse_aug_entry(ET e) : first(std::move(e)), second(NULL) {}
+  sparse_aug_entry(sparse_aug_entry&& o)
+    : first(std::move(o.first)), second(o.second) { o.second = NULL; }
+  sparse_aug_entry(const sparse_aug_entry&) = delete;
+  sparse_aug_entry& operator = (const sparse_aug_entry&) = delete;
+  ~sparse_aug_entry() { delete second; }
+};
+
+template<class balance, class Entry,
+	 template<class> class Allocator = pool_allocator,
+	 size_t threshold = 32>
+struct sparse_aug_node
+  : basic_node<balance, sparse_aug_entry<typename Entry::entry_t,
+					 typename Entry::aug_t>,
+	       Allocator> {
+  using AT = typename Entry::aug_t;
+  using ET = typename Entry::entry_t;
+  using basic = basic_node<balance, sparse_aug_entry<ET,AT>, Allocator>;
+  using node = typename basic::node;
+  using strict = aug_node<balance, Entry, Allocator>;
+
+  static ET& get_entry(node *a) {return a->entry.first;}
+  static ET* get_entry_p(node *a) {return &a->entry.first;}
+  template <class T>
+  static void set_entry(node *a, T&& e) {a->entry.first = std::forward<T>(e);}
+
+  static void combine_into(AT& a, const AT& b) { strict::combine_into(a, b); }
+
+  // the value of a from its children
+  static AT compute(node* a) {
+    AT av = a->lc ? aug_val(a->lc) : Entry::from_entry(get_entry(a));
+    if (a->lc) combine_into(av, Entry::from_entry(get_entry(a)));
+    if (a->rc) combine_into(av, aug_val(a->rc));
+    return av;
+  }
+
+  static AT aug_val(node* a) {
+    if (a == NULL) return Entry::get_empty();
+    if (a->entry.second) return *(a->entry.second);
+    return compute(a);
+  }
+
+  // a is not null
+  static AT aug_ref(node* a) { return aug_val(a); }
+
+  static void update(node* a) {
+    basic::update(a);
+    AT*& p = a->entry.second;
+    if (basic::size(a) >= threshold) {
+      if (p) *p = compute(a);
+      else p = new AT(compute(a));
+    } else if (p) {
+      delete p;
+      p = NULL;
+    }
+  }
+
+  template<class F>
+  static void lazy_update(node* a, F f) { update(a); }
+
+  template <class T>
+  static node* make_node(T&& e) {
+    return basic::make_node(sparse_aug_entry<ET,AT>(ET(std::forward<T>(e))));
+  }
+
+  template <class T>
+  static node* single(T&& e) {
+    return basic::single(sparse_aug_entry<ET,AT>(ET(std::forward<T>(e))));
+  }
+};
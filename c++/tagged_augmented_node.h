@@ -0,0 +1,133 @@
+#pragma once
+#include "augmented_node.h"
+
+// *******************************************
+//   TAGGED AUGMENTED NODE
+// *******************************************
+
+// An augmented node that also carries a pending update (a tag) for the
+// values in its subtree, as in a segment tree.  The entry and augmented
+// value of a node always include its own tag; the tag is still owed to
+// its children.  It is pushed to the children (copying them if they are
+// shared) just before the node gets new children, which is when gc's
+// copy_if_needed is called on it by the joins, so the balancing code
+// needs no changes.  Only the operations in tagged_map.h push tags, so
+// the generic map operations must not be used on these trees.
+// On top of the aug_node interface the Entry needs:
+//   tag_t;
+//   apply(val_t, tag_t) -> val_t;
+//   apply_aug(aug_t, tag_t, size_t n) -> aug_t  -- for a subtree of n entries
+//   compose(tag_t older, tag_t newer) -> tag_t
+
+template <class ET, class AT, class TT>
+struct tagged_aug_entry {
+  ET first;
+  AT second;
+  TT tag;
+  bool tagged;
+};
+
+template<class balance, class Entry,
+	 template<class> class Allocator = pool_allocator>
+struct tagged_aug_node
+  : basic_node<balance, tagged_aug_entry<typename Entry::entry_t,
+					 typename Entry::aug_t,
+					 typename Entry::tag_t>,
+	       Allocator> {
+  using AT = typename Entry::aug_t;
+  using ET = typename Entry::entry_t;
+  using tag_t = typename Entry::tag_t;
+  using TE = tagged_aug_entry<ET,AT,tag_t>;
+  using basic = basic_node<balance, TE, Allocator>;
+  using node = typename basic::node;
+  using strict = aug_node<balance, Entry, Allocator>;
+
+  static ET& get_entry(node *a) {return a->entry.first;}
+  static ET* get_entry_p(node *a) {return &a->entry.first;}
+  template <class T>
+  static void set_entry(node *a, T&& e) {a->entry.first = std::forward<T>(e);}
+
+  static void combine_into(AT& a, const AT& b) { strict::combine_into(a, b); }
+
+  static AT aug_val(node* a) {
+    if (a == NULL) return Entry::get_empty();
+    else return (a->entry).second;}
+
+  // a is not null
+  static const AT& aug_ref(node* a) {return (a->entry).second;}
+
+  // a has no tag
+  static void update(node* a) {
+    basic::update(a);
+    AT av = a->lc ? ((a->lc)->entry).second : Entry::from_entry(get_entry(a));
+    if (a->lc) combine_into(av, Entry::from_entry(get_entry(a)));
+    if (a->rc) combine_into(av, ((a->rc)->entry).second);
+    (a->entry).second = std::move(av);
+  }
+
+  template<class F>
+  static void lazy_update(node* a, F f) { update(a); }
+
+  template <class T>
+  static node* make_node(T&& e) {
+    return basic::make_node(TE{std::forward<T>(e), AT(), tag_t(), false});
+  }
+
+  template <class T>
+  static node* single(T&& e) {
+    AT av = Entry::from_entry(e);
+    return basic::single(TE{std::forward<T>(e), std::move(av), tag_t(), false});
+  }
+
+  static void apply_entry(ET& e, const tag_t& t) {
+    Entry::set_val(e, Entry::apply(Entry::get_val(e), t));
+  }
+
+  // a copy of a sharing its children, with its tag and balance data
+  template <class GC>
+  static node* copy(node* a) {
+    node* r = basic::make_node(a->entry);
+    static_cast<balance&>(*r) = static_cast<balance&>(*a);
+    r->lc = GC::inc(a->lc);  r->rc = GC::inc(a->rc);
+    r->s = a->s;
+    return r;
+  }
+
+  // applies t to the whole subtree of a, consuming a
+  template <class GC>
+  static node* apply_tag(node* a, const tag_t& t) {
+    if (!a) return NULL;
+    if (a->ref_cnt > 1) {
+      node* r = copy<GC>(a);
+      GC::decrement_recursive(a);
+      a = r;
+    }
+    TE& x = a->entry;
+    apply_entry(x.first, t);
+    x.second = Entry::apply_aug(x.second, t, basic::size(a));
+    x.tag = x.tagged ? Entry::compose(x.tag, t) : t;
+    x.tagged = true;
+    return a;
+  }
+
+  // moves the tag of a (which is not shared) to its children
+  template <class GC>
+  static void push(node* a) {
+    if (!(a->entry).tagged) return;
+    a->lc = apply_tag<GC>(a->lc, (a->entry).tag);
+    a->rc = apply_tag<GC>(a->rc, (a->entry).tag);
+    (a->entry).tagged = false;
+  }
+
+  // a version of a that is not shared and has no tag, consuming a
+  template <class GC>
+  static node* own(node* a) {
+    if (a->ref_cnt > 1) {
+      node* r = copy<GC>(a);
+      GC::decrement_recursive(a);
+      a = r;
+    }
+    push<GC>(a);
+    return a;
+  }
+};
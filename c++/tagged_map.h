@@ -0,0 +1,301 @@
+#pragma once
+#include "tagged_augmented_node.h"
+
+using namespace std;
+
+// *******************************************
+//   TAGGED MAPS
+//   Augmented maps with range updates.  range_apply(m, kl, kr, t)
+//   applies the tag t (e.g. "add delta" or "assign x") to every value
+//   with a key in [kl, kr] in O(log n): the O(log n) subtrees covering
+//   the range get t as a pending tag, and their augmented values are
+//   fixed with Entry::apply_aug (e.g. sum += delta * count).  Queries
+//   compose the tags on their path instead of pushing them, so they do
+//   not write to the tree.  Inserts, deletes and range updates push
+//   tags down the paths they change, copying shared nodes as usual, so
+//   older versions are unaffected.
+//   Only the operations here know about tags, so unlike aug_map this
+//   is not built on map_ and supports a smaller interface.
+// *******************************************
+
+template<class Map>
+struct tagged_ops : Map {
+  using Entry = typename Map::Entry;
+  using node = typename Map::node;
+  using ET = typename Map::ET;
+  using GC = typename Map::GC;
+  using K = typename Map::K;
+  using aug_t = typename Entry::aug_t;
+  using tag_t = typename Entry::tag_t;
+  using maybe_T = maybe<tag_t>;
+  using split_info = typename Map::split_info;
+  // the sequence layer, whose update is hidden by map_ops::update
+  using Seq = typename Map::sequence_ops;
+
+  // the tag owed to the children of b, given the tag t owed to b
+  static maybe_T below(node* b, const maybe_T& t) {
+    if (!(b->entry).tagged) return t;
+    if (!t) return maybe_T((b->entry).tag);
+    return maybe_T(Entry::compose((b->entry).tag, t.value));
+  }
+
+  static ET entry_under(node* b, const maybe_T& t) {
+    ET e = Map::get_entry(b);
+    if (t) Map::apply_entry(e, t.value);
+    return e;
+  }
+
+  static aug_t aug_under(node* b, const maybe_T& t) {
+    if (!b) return Entry::get_empty();
+    if (!t) return Map::aug_ref(b);
+    return Entry::apply_aug(Map::aug_ref(b), t.value, Map::size(b));
+  }
+
+  static maybe<ET> find(node* b, const K& k) {
+    maybe_T t;
+    while (b) {
+      bool left = Map::comp(k, Map::get_key(b));
+      if (!left && !Map::comp(Map::get_key(b), k))
+	return maybe<ET>(entry_under(b, t));
+      t = below(b, t);
+      b = left ? b->lc : b->rc;
+    }
+    return maybe<ET>();
+  }
+
+  // the sum of the entries with keys >= k
+  static aug_t aug_geq(node* b, const K& k, maybe_T t) {
+    aug_t r = Entry::get_empty();
+    while (b) {
+      maybe_T tc = below(b, t);
+      if (Map::comp(Map::get_key(b), k)) b = b->rc;
+      else {
+	aug_t x = Entry::combine(Entry::from_entry(entry_under(b, t)),
+				 aug_under(b->rc, tc));
+	r = Entry::combine(x, r);
+	b = b->lc;
+      }
+      t = tc;
+    }
+    return r;
+  }
+
+  // the sum of the entries with keys <= k
+  static aug_t aug_leq(node* b, const K& k, maybe_T t) {
+    aug_t r = Entry::get_empty();
+    while (b) {
+      maybe_T tc = below(b, t);
+      if (Map::comp(k, Map::get_key(b))) b = b->lc;
+      else {
+	aug_t x = Entry::combine(aug_under(b->lc, tc),
+				 Entry::from_entry(entry_under(b, t)));
+	r = Entry::combine(r, x);
+	b = b->rc;
+      }
+      t = tc;
+    }
+    return r;
+  }
+
+  static aug_t aug_range(node* b, const K& kl, const K& kr) {
+    maybe_T t;
+    while (b) {
+      if (Map::comp(Map::get_key(b), kl)) {t = below(b, t); b = b->rc;}
+      else if (Map::comp(kr, Map::get_key(b))) {t = below(b, t); b = b->lc;}
+      else {
+	maybe_T tc = below(b, t);
+	aug_t r = Entry::combine(aug_geq(b->lc, kl, tc),
+				 Entry::from_entry(entry_under(b, t)));
+	return Entry::combine(r, aug_leq(b->rc, kr, tc));
+      }
+    }
+    return Entry::get_empty();
+  }
+
+  // all entries in order, with their tags applied
+  static void entries(node* b, ET* out, maybe_T t = maybe_T()) {
+    if (!b) return;
+    maybe_T tc = below(b, t);
+    size_t l = Map::size(b->lc);
+    out[l] = entry_under(b, t);
+    utils::fork_no_result(Map::size(b) >= utils::node_limit,
+      [&] () {entries(b->lc, out, tc);},
+      [&] () {entries(b->rc, out + l + 1, tc);});
+  }
+
+  // Applies t to the values of b with keys in [kl, kr].  all_l (all_r)
+  // means every key in b is >= kl (<= kr).  Consumes b.
+  static node* range_apply(node* b, const K& kl, const K& kr,
+			   const tag_t& t, bool all_l = false,
+			   bool all_r = false) {
+    if (!b) return NULL;
+    if (all_l && all_r) return Map::template apply_tag<GC>(b, t);
+    b = Map::template own<GC>(b);
+    bool ge = !Map::comp(Map::get_key(b), kl);
+    bool le = !Map::comp(kr, Map::get_key(b));
+    if (ge && le) {
+      Map::apply_entry(Map::get_entry(b), t);
+      b->lc = range_apply(b->lc, kl, kr, t, all_l, true);
+      b->rc = range_apply(b->rc, kl, kr, t, true, all_r);
+    } else if (!ge) b->rc = range_apply(b->rc, kl, kr, t, false, all_r);
+    else b->lc = range_apply(b->lc, kl, kr, t, all_l, false);
+    Seq::update(b);
+    return b;
+  }
+
+  // as split_inplace, pushing tags on the way down
+  static split_info split(node* b, const K& k) {
+    if (!b) return split_info(NULL, NULL, false);
+    b = Map::template own<GC>(b);
+    if (Map::comp(Map::get_key(b), k)) {
+      split_info s = split(b->rc, k);
+      s.first = Map::node_join(b->lc, s.first, b);
+      return s;
+    } else if (Map::comp(k, Map::get_key(b))) {
+      split_info s = split(b->lc, k);
+      s.second = Map::node_join(s.second, b->rc, b);
+      return s;
+    } else {
+      split_info s(b->lc, b->rc, true);
+      s.entry = Map::get_entry(b);
+      GC::decrement(b);
+      return s;
+    }
+  }
+
+  static node* join2(node* a, node* b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (Map::size(a) > Map::size(b)) {
+      a = Map::template own<GC>(a);
+      return Map::node_join(a->lc, join2(a->rc, b), a);
+    } else {
+      b = Map::template own<GC>(b);
+      return Map::node_join(join2(a, b->lc), b->rc, b);
+    }
+  }
+
+  template <class BinaryOp>
+  static node* insert(node* b, const ET& e, const BinaryOp& op) {
+    split_info s = split(b, Entry::get_key(e));
+    ET x = e;
+    if (s.removed)
+      Entry::set_val(x, op(Entry::get_val(s.entry), Entry::get_val(e)));
+    return Map::node_join(s.first, s.second, Map::make_node(x));
+  }
+
+  static node* remove(node* b, const K& k) {
+    split_info s = split(b, k);
+    return join2(s.first, s.second);
+  }
+};
+
+// _Entry needs the aug_map interface, and
+//    tag_t,
+//    apply(val_t, tag_t) -> val_t,
+//    apply_aug(aug_t, tag_t, size_t) -> aug_t,
+//    compose(tag_t older, tag_t newer) -> tag_t
+template <class _Entry, class Balance=weight_balanced_tree,
+	  template<class> class Allocator=pool_allocator>
+class tagged_aug_map {
+public:
+  using Entry = aug_map_full_entry<_Entry>;
+  using Join_Tree = typename Balance::template
+    balance<tagged_aug_node<typename Balance::data, Entry, Allocator>>;
+  using Tree = tagged_ops<map_ops<sequence_ops<Join_Tree>, Entry>>;
+  using node = typename Tree::node;
+  using GC = typename Tree::GC;
+  using E = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+  using A = typename Entry::aug_t;
+  using T = typename Entry::tag_t;
+  using M = tagged_aug_map;
+  using maybe_V = maybe<V>;
+
+  static void init() { GC::init(); }
+  static void finish() { GC::finish(); }
+
+  tagged_aug_map() : root(NULL) { GC::init(); }
+
+  // from a sequence, keeping the last of equal keys
+  tagged_aug_map(pbbs::sequence<E> const &S) {
+    GC::init();
+    auto get_key = [] (const E& e) {return Entry::get_key(e);};
+    pbbs::sequence<E> B = build<Entry>::sort_keep_last(S, get_key);
+    root = Tree::from_array(B.begin(), B.size());
+  }
+
+  tagged_aug_map(const M& m) { root = m.root; GC::increment(root); }
+  tagged_aug_map(M&& m) { root = m.root; m.root = NULL; }
+
+  M& operator = (const M& m) {
+    if (this != &m) { clear(); root = m.root; GC::increment(root); }
+    return *this;
+  }
+
+  M& operator = (M&& m) {
+    if (this != &m) { clear(); root = m.root; m.root = NULL; }
+    return *this;
+  }
+
+  ~tagged_aug_map() { clear(); }
+
+  void clear() { GC::decrement_recursive(root); root = NULL; }
+
+  size_t size() const { return Tree::size(root); }
+  bool is_empty() const { return root == NULL; }
+
+  maybe_V find(const K& key) const {
+    maybe<E> e = Tree::find(root, key);
+    if (e) return maybe_V(Entry::get_val(e.value));
+    else return maybe_V();
+  }
+
+  bool contains(const K& key) const { return Tree::find(root, key); }
+
+  A aug_val() const { return Tree::aug_val(root); }
+
+  // the sum over keys in [key_left, key_right]
+  A aug_range(const K& key_left, const K& key_right) const {
+    return Tree::aug_range(root, key_left, key_right); }
+
+  static pbbs::sequence<E> entries(const M& m) {
+    pbbs::sequence<E> out(m.size());
+    Tree::entries(m.root, out.begin());
+    return out;
+  }
+
+  // applies t to the values with keys in [key_left, key_right]
+  static M range_apply(M m, const K& key_left, const K& key_right,
+		       const T& t) {
+    return M(Tree::range_apply(m.get_root(), key_left, key_right, t)); }
+
+  void range_apply(const K& key_left, const K& key_right, const T& t) {
+    root = Tree::range_apply(root, key_left, key_right, t); }
+
+  template <class F>
+  static M insert(M m, const E& e, const F& f) {
+    return M(Tree::insert(m.get_root(), e, f)); }
+
+  static M insert(M m, const E& e) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    return M(Tree::insert(m.get_root(), e, replace)); }
+
+  void insert(const E& e) {
+    auto replace = [] (const V& a, const V& b) {return b;};
+    root = Tree::insert(root, e, replace); }
+
+  static M remove(M m, const K& k) {
+    return M(Tree::remove(m.get_root(), k)); }
+
+  void remove(const K& k) { root = Tree::remove(root, k); }
+
+  bool check_balance() const { return Tree::check_balance(root); }
+
+private:
+  node* root;
+
+  explicit tagged_aug_map(node* n) : root(n) { GC::init(); }
+  node* get_root() {node* t = root; root = NULL; return t;}
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// *******************************************
+//   TRANSIENT MAPS
+//   A single-owner mutable handle on a map (or aug_map).  It takes
+//   over the root of a persistent map, is updated in place, and is
+//   turned back into a persistent map with persistent().
+//   Nodes still shared with other maps are path-copied the first
+//   time they are touched, all other nodes are reused, and joins on
+//   the way up only rebalance when needed.
+//   Plain inserts (overwrite semantics) are buffered and applied as a
+//   sorted batch with multi_insert_sorted, which is far more cache
+//   friendly than descending the tree once per key, and makes
+//   appends of increasing keys O(1) amortized apart from a join per
+//   batch.  Any other operation flushes the buffer first.
+//   Not safe for concurrent use, and not copyable.
+// *******************************************
+
+template <class Map>
+class transient_map {
+public:
+  using M = Map;
+  using Tree = typename M::Tree;
+  using GC = typename M::GC;
+  using Entry = typename M::Entry;
+  using node = typename M::node;
+  using E = typename Entry::entry_t;
+  using K = typename Entry::key_t;
+  using V = typename Entry::val_t;
+  using maybe_V = maybe<V>;
+
+  static constexpr size_t buffer_limit = 1 << 14;
+
+  transient_map() : root(NULL) { GC::init(); }
+
+  // takes over the root of m, leaving m empty
+  explicit transient_map(M&& m) : root(m.get_root()) { GC::init(); }
+
+  transient_map(const transient_map&) = delete;
+  transient_map& operator = (const transient_map&) = delete;
+
+  transient_map(transient_map&& t)
+    : root(t.root), buf(std::move(t.buf)) { t.root = NULL; }
+
+  transient_map& operator = (transient_map&& t) {
+    if (this != &t) {
+      clear(); root = t.root; t.root = NULL; buf = std::move(t.buf); }
+    return *this;
+  }
+
+  ~transient_map() { clear(); }
+
+  void clear() {
+    GC::decrement_recursive(root); root = NULL; buf.clear(); }
+
+  size_t size() { flush(); return Tree::size(root); }
+  bool is_empty() { return root == NULL && buf.empty(); }
+
+  maybe_V find(const K& key) {
+    flush();
+    node* a = Tree::find(root, key);
+    if (a != NULL) return maybe_V(Entry::get_val(Tree::get_entry(a)));
+    else return maybe_V();
+  }
+
+  bool contains(const K& key) {
+    flush(); return Tree::find(root, key) != NULL;}
+
+  template <class Func>
+  void insert(const E& p, const Func& f) {
+    flush(); root = Tree::insert_owned(root, p, f); }
+
+  // overwrites any existing entry with the same key
+  void insert(const E& p) {
+    buf.push_back(p);
+    if (buf.size() >= buffer_limit) flush();
+  }
+
+  template <class Func>
+  void update(const K& k, const Func& f) {
+    flush(); root = Tree::update_owned(root, k, f); }
+
+  void remove(const K& k) {
+    flush(); root = Tree::deletet(root, k); }
+
+  // applies buffered inserts, the last insert of a key wins.
+  // Streams of increasing keys (appends) skip the sort and are joined
+  // onto the right spine of the tree by append_sorted.
+  void flush() {
+    if (buf.empty()) return;
+    auto replace = [] (const V& a, const V& b) {return b;};
+    bool increasing = true;
+    for (size_t i = 1; i < buf.size() && increasing; i++)
+      increasing = Entry::comp(Entry::get_key(buf[i-1]),
+			       Entry::get_key(buf[i]));
+    if (increasing) {
+      root = Tree::append_sorted(root, buf.data(), buf.size(), replace);
+    } else {
+      auto get_key = [] (const E& e) {return Entry::get_key(e);};
+      pbbs::sequence<E> A = build<Entry>::sort_keep_last(
+			      pbbs::range<E*>(buf.data(), buf.data() + buf.size()),
+			      get_key);
+      root = Tree::append_sorted(root, A.begin(), A.size(), replace);
+    }
+    buf.clear();
+  }
+
+  // freezes the contents into a persistent map, leaving this empty
+  M persistent() {
+    flush();
+    node* t = root; root = NULL;
+    return M(t);
+  }
+
+private:
+  node* root;
+  std::vector<E> buf;
+};
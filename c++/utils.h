@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 
 // *******************************************
 //   Utils
@@ -10,6 +11,11 @@ namespace utils {
   // processed sequentially instead of in parallel
   constexpr const size_t node_limit = 100;
 
+  // set operations (union, intersect, difference) on subtrees with at
+  // most this many entries in total flatten them and merge instead of
+  // recursing.  0 turns it off.
+  inline size_t set_base_size = 64;
+
 
   // for two input sizes of n and m, should we do a parallel fork
   // assumes work proportional to m log (n/m + 1)
@@ -26,11 +32,11 @@ namespace utils {
       auto do_right = [&] () {r = right();};
       auto do_left = [&] () {l = left();};
       par_do(do_left, do_right);
-      return std::pair<RT,RT>(l,r);
+      return std::pair<RT,RT>(std::move(l), std::move(r));
     } else {
       RT l = left(); 
       RT r = right();
-      return std::make_pair(l,r);
+      return std::make_pair(std::move(l), std::move(r));
     }
   }
 
@@ -41,6 +47,14 @@ namespace utils {
     else {left(); right();}
   }
 
+  // shared by the branches of a parallel search.  The branch that
+  // finds a match cancels it, and the others check it before each node.
+  struct cancel_token {
+    std::atomic<bool> flag{false};
+    bool cancelled() const {return flag.load(std::memory_order_relaxed);}
+    void cancel() {flag.store(true, std::memory_order_relaxed);}
+  };
+
   template<class V>
   struct get_left {
     V operator () (const V& a, const V& b) const
@@ -56,7 +56,7 @@ struct inv_index {
 
   inv_index() {}
       
-  post_list get_list(const token w) {
+  post_list get_list(const token& w) {
     maybe<post_list> p = idx.find(w);
     if (p) return *p;
     else return post_list();
@@ -68,6 +68,13 @@ struct inv_index {
   static post_list Or(post_list a, post_list b) {
     return post_list::map_union(a,b,add);}
 
+  // for queries with many terms, one pass over all the lists
+  static post_list And(vector<post_list> lists) {
+    return post_list::map_intersect_k(std::move(lists), add);}
+
+  static post_list Or(vector<post_list> lists) {
+    return post_list::map_union_k(std::move(lists), add);}
+
   static post_list And_Not(post_list a, post_list b) {
     return post_list::map_difference(a,b);}
 
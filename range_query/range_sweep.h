@@ -32,6 +32,7 @@ struct RangeQuery {
     static aug_t get_empty() {return 0;}
     static aug_t from_entry(key_t k, val_t v) {return v;}
     static aug_t combine(aug_t a, aug_t b) {return a + b;}
+    static aug_t inverse(aug_t a) {return -a;}
   };
 
   using c_map = aug_map<map_t>;
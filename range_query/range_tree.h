@@ -56,6 +56,9 @@ struct RangeQuery {
     inline static aug_t combine(aug_t a, aug_t b) {
       return aug_t::map_union(a, b, [](w_type x, w_type y) {return x+y;});
     }
+    inline static void combine_inplace(aug_t& a, const aug_t& b) {
+      a = aug_t::map_union(std::move(a), b, [](w_type x, w_type y) {return x+y;});
+    }
     static aug_t get_empty() { return aug_t();}
   };
 
@@ -335,6 +335,21 @@ double test_insertion_build(size_t n) {
   return tm;
 }
 
+double test_insertion_build_transient(size_t n) {
+  pbbs::sequence<par> v = uniform_input(n, 20, true);
+  tmap m1;
+
+  timer t;
+  t.start();
+  auto tr = tmap::to_transient(std::move(m1));
+  for (size_t i = 0; i < n; ++i) {
+    tr.insert(v[i]);
+  }
+  m1 = tr.persistent();
+  double tm = t.stop();
+  return tm;
+}
+
 double test_insertion_build_persistent(size_t n) {
   pbbs::sequence<par> v = uniform_input(n, 20, true);
   tmap m1;
@@ -845,6 +860,7 @@ string test_name[] = {
   "intersect_multi_type", //27
   "flat_aug_range", //28
   "test_map_reduce", //29
+  "test_insertion_build_transient", //30
   "nothing" 
 };
 
@@ -861,9 +877,9 @@ double flat_aug_range(size_t n, size_t m) {
   timer t;
   t.start();
   parallel_for(0, m, [&] (size_t i) {
-      tmap m2 = tmap::range(m1, v2[i].first, v2[i].first+win);
       auto f = [] (par e) { return e.second;};
-      v3[i] = tmap::map_reduce(m2, f, Add());
+      v3[i] = tmap::map_reduce_range(m1, v2[i].first, v2[i].first+win,
+				     f, Add());
     });
    
   double tm = t.stop();
@@ -936,6 +952,8 @@ double execute(size_t id, size_t n, size_t m) {
     return flat_aug_range(n,m);
   case 29:
     return test_map_reduce(n);
+  case 30:
+    return test_insertion_build_transient(n);
   default: 
     assert(false);
     return 0.0;
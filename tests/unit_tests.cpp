@@ -2,6 +2,7 @@
 #include "../index/index.h"
 #include <iostream>
 #include <algorithm>
+#include <set>
 using namespace std;
 
 struct entry {
@@ -458,11 +459,879 @@ void test_set () {
   check(sc.size() == 10, "set size check sc");
 }
 
+void test_blocked() {
+  struct set_entry {
+    using key_t = int;
+    static inline bool comp(key_t a, key_t b) { return a < b;}
+  };
+  using bset = pam_blocked_set<set_entry, 4>;
+  using bmap = pam_blocked_map<entry2, 4>;
+  using std_set = std::set<int>;
+
+  size_t n = 2000;
+  pbbs::sequence<int> a(n, [&] (size_t i) {return (int) ((i * 7919) % 5003);});
+  pbbs::sequence<int> b(n/3, [&] (size_t i) {return (int) ((i * 104729) % 4001);});
+  std_set sa(a.begin(), a.end()), sb(b.begin(), b.end());
+
+  bset ba(a), bb(b);
+  check(ba.size() == sa.size(), "blocked size check");
+  check(bset::num_used_nodes() < sa.size() / 4, "blocked node count check");
+  check(ba.contains(a[17]) && !ba.contains(5003), "blocked contains check");
+
+  std_set su = sa, si, sd;
+  su.insert(sb.begin(), sb.end());
+  for (int x : sa) if (sb.count(x)) si.insert(x); else sd.insert(x);
+
+  bset bu = bset::map_union(ba, bb);
+  bset bi = bset::map_intersect(ba, bb);
+  bset bd = bset::map_difference(ba, bb);
+  check(bu.size() == su.size(), "blocked union size");
+  check(bi.size() == si.size(), "blocked intersect size");
+  check(bd.size() == sd.size(), "blocked difference size");
+  check(ba.size() == sa.size(), "blocked persistence check");
+
+  pbbs::sequence<int> keys(bu.size());
+  bset::keys(bu, keys.begin());
+  check(std::equal(keys.begin(), keys.end(), su.begin()), "blocked union keys");
+
+  struct Add {
+    using T = long;
+    static T identity() { return 0;}
+    static T add(T a, T b) { return a + b;}
+  };
+  long sum = 0;
+  for (int x : sd) sum += x;
+  check(bset::map_reduce(bd, [] (int k) -> long {return k;}, Add()) == sum,
+	"blocked map_reduce check");
+
+  bset bf = bset::filter(bu, [] (int k) {return (k & 1) == 0;});
+  size_t evens = 0;
+  for (int x : su) evens += ((x & 1) == 0);
+  check(bf.size() == evens, "blocked filter size");
+
+  bu = bset::remove(std::move(bu), keys[5]);
+  check(!bu.contains(keys[5]) && bu.size() == su.size() - 1, "blocked remove");
+
+  elt2 c[5] = {elt2(3, true), elt2(9, false), elt2(1, true),
+	       elt2(7, true), elt2(5, false)};
+  bmap mc(c, c+5);
+  auto orf = [] (bool x, bool y) {return x || y;};
+  mc = bmap::insert(std::move(mc), elt2(9, true), orf);
+  check(mc.size() == 5 && *mc.find(9), "blocked map insert combine");
+  pbbs::sequence<elt2> d = {elt2(4, true), elt2(5, true)};
+  mc = bmap::multi_insert(std::move(mc), d);
+  check(mc.size() == 6 && *mc.find(5), "blocked map multi_insert");
+
+  ba.clear(); bb.clear(); bu.clear(); bi.clear(); bd.clear(); bf.clear(); mc.clear();
+  check(bset::num_used_nodes() == 0 && bset::num_used_leaves() == 0,
+	"blocked used nodes at end");
+}
+
+template <template <class> class Encoder>
+void test_blocked_encoded() {
+  struct set_entry {
+    using key_t = int;
+    static inline bool comp(key_t a, key_t b) { return a < b;}
+  };
+  using eset = pam_blocked_set<set_entry, 8, Encoder>;
+  using emap = pam_blocked_map<entry, 8, Encoder>;
+
+  size_t n = 3000;
+  pbbs::sequence<int> a(n, [&] (size_t i) {return (int) (3*i - 1000);});
+  pbbs::sequence<int> b(n, [&] (size_t i) {return (int) (5*i + (i%7)*100000);});
+  std::set<int> sa(a.begin(), a.end()), sb(b.begin(), b.end());
+  eset ea(a), eb(b);
+  check(ea.size() == sa.size() && eb.size() == sb.size(), "encoded size");
+  check(ea.contains(-1000) && ea.contains(2) && !ea.contains(3), "encoded find");
+
+  std::set<int> su = sa, si;
+  su.insert(sb.begin(), sb.end());
+  for (int x : sa) if (sb.count(x)) si.insert(x);
+  eset eu = eset::map_union(ea, eb);
+  eset ei = eset::map_intersect(ea, eb);
+  check(eu.size() == su.size() && ei.size() == si.size(), "encoded set ops");
+  pbbs::sequence<int> keys(eu.size());
+  eset::keys(eu, keys.begin());
+  check(std::equal(keys.begin(), keys.end(), su.begin()), "encoded union keys");
+
+  struct Add {
+    using T = long;
+    static T identity() { return 0;}
+    static T add(T a, T b) { return a + b;}
+  };
+  long sum = 0;
+  for (int x : si) sum += x;
+  check(eset::map_reduce(ei, [] (int k) -> long {return k;}, Add()) == sum,
+	"encoded map_reduce");
+
+  pbbs::sequence<elt> c(n, [&] (size_t i) {return elt(7*i, i);});
+  emap mc(c);
+  check(*mc.find(70) == 10 && !mc.find(71), "encoded map find");
+  mc = emap::insert(std::move(mc), elt(70, 5), [] (int x, int y) {return x+y;});
+  check(*mc.find(70) == 15, "encoded map insert combine");
+
+  ea.clear(); eb.clear(); eu.clear(); ei.clear(); mc.clear();
+  check(eset::num_used_leaves() == 0 && emap::num_used_leaves() == 0,
+	"encoded used leaves at end");
+}
+
 using wb_map  = aug_map<entry,weight_balanced_tree>;
 using rb_map  = aug_map<entry,red_black_tree>;
 using treap_map  = aug_map<entry,treap<entry>>;
 using avl_map  = aug_map<entry,avl_tree>;
 
+template <class map>
+void test_transient() {
+  size_t n = 2000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt((i*7919)%n, i);});
+  map base(pbbs::sequence<elt>(10, [&] (size_t i) {return elt(2*i, 1);}));
+  map keep = base;
+
+  auto tr = map::to_transient(std::move(base));
+  check(base.size() == 0, "transient takes root");
+  for (size_t i = 0; i < n; i++) tr.insert(a[i]);
+  tr.insert(elt(4, 10), [] (int x, int y) {return x + y;});
+  tr.remove(6);
+  check(tr.size() == n - 1 && !tr.contains(6), "transient size");
+  int v4 = 0;
+  for (size_t i = 0; i < n; i++) if (a[i].first == 4) v4 = a[i].second;
+  check(*tr.find(4) == v4 + 10, "transient find");
+
+  map m = tr.persistent();
+  check(tr.size() == 0, "transient frozen");
+  check(m.size() == n - 1 && map::Tree::check_balance(m.root), "transient balance");
+  check(keep.size() == 10 && *keep.find(4) == 1 && keep.contains(6),
+	"transient leaves shared map unchanged");
+  float total = 0;
+  for (size_t i = 0; i < n; i++) if (a[i].first != 6) total += a[i].second/2.0;
+  check(m.aug_val() == total + 5.0, "transient aug value");
+  m.clear(); keep.clear();
+}
+
+void test_multi_apply() {
+  size_t n = 1000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, 1);});
+  map ma(a);
+  map keep = ma;
+
+  pbbs::sequence<int> del(300, [&] (size_t i) {return (int) ((7*i) % 900);});
+  map md = map::multi_delete(ma, del);
+  std::set<int> gone(del.begin(), del.end());
+  size_t removed = 0;
+  for (int k : gone) if (k % 2 == 0) removed++;
+  check(md.size() == n - removed && !md.contains(0) && md.contains(2),
+	"multi_delete size");
+
+  // insert odd keys, bump keys divisible by 3, delete keys divisible by 5
+  pbbs::sequence<map::tagged_op> ops(3*n, [&] (size_t i) {
+      int k = (int) (i % (2*n));
+      if (k % 5 == 0) return map::tagged_op(elt(k, 0), map::batch_delete);
+      if (k % 3 == 0) return map::tagged_op(elt(k, 10), map::batch_update);
+      return map::tagged_op(elt(k, 3), map::batch_insert);});
+  auto add = [] (int x, int y) {return x + y;};
+  ma = map::multi_apply(std::move(ma), ops, add);
+  float total = 0; size_t cnt = 0;
+  for (int k = 0; k < (int) (2*n); k++) {
+    if (k % 5 == 0) {
+      check(!ma.contains(k), "multi_apply delete"); continue;}
+    if (k % 3 == 0 && k % 2 == 1) {
+      check(!ma.contains(k), "multi_apply update missing"); continue;}
+    int v = (k % 3 == 0) ? 11 : 3;
+    check(*ma.find(k) == v, "multi_apply value");
+    total += v/2.0; cnt++;
+  }
+  check(ma.size() == cnt && ma.aug_val() == total, "multi_apply size and aug");
+  check(keep.size() == n && *keep.find(6) == 1, "multi_apply persistence");
+  ma.clear(); md.clear(); keep.clear();
+}
+
+void test_multi_find() {
+  size_t n = 1000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(3*i, i);});
+  map ma(a);
+
+  size_t m = 2500;
+  pbbs::sequence<int> q(m, [&] (size_t i) {return (int) ((i*7919) % (3*n+50));});
+  pbbs::sequence<maybe<int>> out(m);
+  map::multi_find(ma, q, out.begin());
+  for (size_t i = 0; i < m; i++) {
+    bool in = q[i] % 3 == 0 && q[i] < (int) (3*n);
+    check((bool) out[i] == in, "multi_find presence");
+    if (in) check(*out[i] == q[i]/3, "multi_find value");
+  }
+
+  pbbs::sequence<int> qs(m, [&] (size_t i) {return (int) (i/2);});
+  map::multi_find_sorted(ma, qs, out.begin());
+  for (size_t i = 0; i < m; i++)
+    check((bool) out[i] == (qs[i] % 3 == 0) &&
+	  (!out[i] || *out[i] == qs[i]/3), "multi_find_sorted");
+  ma.clear();
+}
+
+void test_range_reduce() {
+  size_t n = 1000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, i);});
+  map ma(a);
+  struct Add {
+    using T = long;
+    static T identity() { return 0;}
+    static T add(T a, T b) { return a + b;}
+  };
+  auto f = [] (elt e) -> long {return e.second;};
+  size_t used = map::GC::num_used_nodes();
+  for (int lo = -3; lo < 40; lo += 7)
+    for (int hi = lo; hi < 2100; hi += 97) {
+      map mr = map::range(ma, lo, hi);
+      check(map::map_reduce_range(ma, lo, hi, f, Add(), 4) ==
+	    map::map_reduce(mr, f, Add()), "map_reduce_range");
+      pbbs::sequence<elt> e(mr.size());
+      map::entries(mr, e.begin());
+      pbbs::sequence<elt> out(e.size());
+      map::foreach_range(ma, lo, hi,
+			 [&] (elt& x, size_t i) {out[i] = x;}, 4);
+      check(std::equal(e.begin(), e.end(), out.begin()), "foreach_range");
+    }
+  check(map::GC::num_used_nodes() == used, "range reduce allocates nothing");
+  check(map::map_reduce_range(ma, 5, 3, f, Add()) == 0, "empty range");
+  ma.clear();
+}
+
+void test_snapshot() {
+  using smap = aug_map<entry, avl_tree>;
+  size_t n = 500;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(i, 2);});
+  {
+    snapshot_map<smap> m{smap(a)};
+    auto s = m.snapshot();
+    check(m.current().root->ref_cnt == 2, "snapshot does not touch ref count");
+    // replace the viewed version, then drop the writer's copy
+    m.update([] (smap c) {return smap::insert(std::move(c), elt(1000, 4));});
+    m.publish(smap());
+    check(s.size() == n && *s.find(7) == 2 && !s.contains(1000),
+	  "snapshot survives drop");
+    check(s.aug_val() == n && s.aug_range(10, 19) == 10, "snapshot aug");
+    struct Add {
+      using T = long;
+      static T identity() { return 0;}
+      static T add(T a, T b) { return a + b;}
+    };
+    auto f = [] (elt e) -> long {return e.second;};
+    check(s.map_reduce(f, Add()) == (long) (2*n), "snapshot map_reduce");
+    smap c = s.to_map();
+    check(c.size() == n, "snapshot to_map");
+  }
+  {
+    // updates of the current version do not write to the viewed one
+    snapshot_map<smap> u{smap(a)};
+    auto s = u.snapshot();
+    u.update([] (smap c) {return smap::insert(std::move(c), elt(3, 9));});
+    u.update([] (smap c) {c.insert(elt(4, 9)); return c;});
+    smap c = u.current();
+    check(*c.find(3) == 9 && *c.find(4) == 9 && *s.find(3) == 2 &&
+	  *s.find(4) == 2 && s.aug_val() == n, "snapshot of updated map");
+  }
+  {
+    // ordinary maps still update their only copy in place
+    smap o(a);
+    smap::node* r = o.root;
+    o.insert(elt(5, 9));
+    check(o.root == r, "unviewed maps update in place");
+  }
+  {
+    snapshot_map<smap> m{smap(a)};
+    pbbs::sequence<size_t> found(100);
+    parallel_for(0, 100, [&] (size_t i) {
+	auto s = m.snapshot();
+	found[i] = s.contains(i) + s.size();});
+    check(found[99] == n+1, "parallel snapshots");
+  }
+  epoch::flush();
+  check(smap::GC::num_used_nodes() == 0, "snapshot versions reclaimed");
+}
+
+void test_reclaim() {
+  using rmap = pam_map<entry2, weight_balanced_tree, hugepage_allocator>;
+  using pmap = pam_map<entry2>;
+  reclaim::start(2);
+  size_t n = 100000;
+  pbbs::sequence<elt2> a(n, [&] (size_t i) {return elt2(i, true);});
+  rmap m(a);
+  rmap m2 = rmap::insert(m, elt2(-1, false));
+  size_t before = reclaim::num_enqueued();
+  m.clear();  // the old version goes to the background threads
+  check(reclaim::num_enqueued() > before, "reclaim enqueued");
+  check(m2.size() == n + 1 && *m2.find(5), "reclaim keeps shared nodes");
+  m2.clear();
+  reclaim::drain();
+  check(reclaim::pending() == 0, "reclaim drained");
+  check(rmap::GC::num_used_nodes() == 0, "reclaim freed all nodes");
+
+  // blocks freed by the workers are reused by the building thread
+  size_t allocated = 0;
+  for (size_t round = 0; round < 5; round++) {
+    rmap r(a);
+    if (round == 1) allocated = rmap::GC::alloc::num_allocated_blocks();
+    r.clear();
+    reclaim::drain();
+  }
+  check(rmap::GC::alloc::num_allocated_blocks() == allocated,
+	"reclaim does not strand freed blocks");
+
+  // the default pool frees on the dropping thread
+  pmap p(a);
+  before = reclaim::num_enqueued();
+  p.clear();
+  check(!pmap::GC::reclaimable && reclaim::num_enqueued() == before,
+	"reclaim skips the default pool");
+  reclaim::stop();
+}
+
+void test_allocators() {
+  using amap = pam_map<entry2, weight_balanced_tree, arena_allocator>;
+  using hmap = aug_map<entry, avl_tree, hugepage_allocator>;
+  size_t n = 100000;
+  {
+    pbbs::sequence<elt2> a(n, [&] (size_t i) {return elt2(2*i, true);});
+    pbbs::sequence<elt2> b(n, [&] (size_t i) {return elt2(2*i+1, false);});
+    amap ma(a), mb(b);
+    amap mc = amap::map_union(ma, mb);
+    check(mc.size() == 2*n && *mc.find(4) && !*mc.find(5), "arena union");
+    pbbs::sequence<elt> c(n, [&] (size_t i) {return elt(i, 2);});
+    hmap h(c);
+    hmap h2 = hmap::insert(h, elt(n, 2));
+    check(h2.size() == n+1 && h2.aug_val() == n+1, "hugepage insert");
+    check(hmap::GC::num_used_nodes() > 0, "hugepage used nodes");
+  }
+  check(amap::GC::num_used_nodes() == 0, "arena nodes freed");
+  check(hmap::GC::num_used_nodes() == 0, "hugepage nodes freed");
+  amap::finish();
+  hmap::finish();
+}
+
+void test_numa() {
+  using nmap = aug_map<entry, weight_balanced_tree, numa_allocator>;
+  check(numa::num_nodes() >= 1 && numa::current_node() < numa::num_nodes(),
+	"numa topology");
+  size_t n = 100000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(i, 2);});
+  nmap m(a);
+  nmap m2 = m;
+  m = nmap::interleave_top(std::move(m), 6);
+  check(m.size() == n && m.aug_val() == n && *m.find(77) == 2,
+	"numa interleave top");
+  check(nmap::GC::num_used_nodes() == n + 63, "numa top copied");
+  m2.clear();
+  check(nmap::GC::num_used_nodes() == n, "numa old top freed");
+  m.clear();
+  check(nmap::GC::num_used_nodes() == 0, "numa nodes freed");
+}
+
+// a key type that counts its copies
+struct counted_key {
+  static inline std::atomic<size_t> copies{0};
+  int k;
+  counted_key(int k = 0) : k(k) {}
+  counted_key(const counted_key& o) : k(o.k) { copies++; }
+  counted_key& operator = (const counted_key& o) { k = o.k; copies++; return *this; }
+};
+
+void test_no_key_copies() {
+  struct ck_entry {
+    using key_t = counted_key;
+    using val_t = int;
+    static bool comp(const key_t& a, const key_t& b) { return a.k < b.k;}
+  };
+  using cmap = pam_map<ck_entry>;
+  size_t n = 10000;
+  pbbs::sequence<pair<counted_key,int>> a(n, [&] (size_t i) {
+      return make_pair(counted_key(i), (int) i);});
+  cmap m(a);
+  counted_key::copies = 0;
+  bool ok = true;
+  for (size_t i = 0; i < n; i += 7) ok = ok && (*m.find(counted_key(i)) == (int) i);
+  size_t r = m.rank(counted_key(n/2));
+  check(ok && r == n/2, "counted key find");
+  check(counted_key::copies == 0, "find and rank do not copy keys");
+}
+
+struct entry_inplace {
+  using key_t = int;
+  using val_t = int;
+  using aug_t = long;
+  static inline std::atomic<size_t> calls{0};
+  static inline bool comp(key_t a, key_t b) { return a < b;}
+  static aug_t get_empty() { return 0;}
+  static aug_t from_entry(key_t k, val_t v) { return v;}
+  static aug_t combine(aug_t a, aug_t b) { return a + b;}
+  static void combine_inplace(aug_t& a, const aug_t& b) { calls++; a += b;}
+};
+
+void test_aug_inplace() {
+  using imap = aug_map<entry_inplace>;
+  size_t n = 10000;
+  pbbs::sequence<pair<int,int>> a(n, [&] (size_t i) {
+      return make_pair((int) i, 1);});
+  imap m(a);
+  check(m.aug_val() == (long) n && entry_inplace::calls > 0,
+	"combine_inplace used");
+  check(m.aug_range(10, 19) == 10, "combine_inplace range");
+
+  // removing absent keys from a shared tree reuses its nodes
+  imap m2 = imap::remove(m, -5);
+  check(m2.root == m.root, "unchanged remove reuses root");
+  pbbs::sequence<int> d = {-3, -2, 100000};
+  imap m3 = imap::multi_delete(m, d);
+  check(m3.root == m.root && m3.aug_val() == (long) n,
+	"unchanged multi_delete");
+  imap m4 = imap::remove(m, 5);
+  check(m4.size() == n-1 && m4.aug_val() == (long) n-1 &&
+	m.aug_val() == (long) n, "changed remove");
+}
+
+struct entry_counted {
+  using key_t = int;
+  using val_t = int;
+  using aug_t = long;
+  static inline std::atomic<size_t> combines{0};
+  static inline bool comp(key_t a, key_t b) { return a < b;}
+  static aug_t get_empty() { return 0;}
+  static aug_t from_entry(key_t k, val_t v) { return v;}
+  static aug_t combine(aug_t a, aug_t b) { combines++; return a + b;}
+};
+
+void test_lazy_aug() {
+  using lmap = lazy_aug_map<entry_counted>;
+  size_t n = 10000;
+  pbbs::sequence<pair<int,int>> a(n, [&] (size_t i) {
+      return make_pair((int) i, (int) i % 10);});
+  long sum = 45 * (n/10);
+  entry_counted::combines = 0;
+  lmap m(a);
+  lmap m2 = lmap::insert(m, make_pair(-1, 100));
+  check(entry_counted::combines == 0, "lazy build does not combine");
+  check(m2.aug_val() == sum + 100, "lazy aug_val");
+  size_t c = entry_counted::combines;
+  check(m2.aug_val() == sum + 100 && entry_counted::combines == c,
+	"lazy aug_val cached");
+  check(m.aug_range(10, 19) == 45 && m.aug_left(9) == 45, "lazy aug range");
+  lmap f = lmap::aug_filter(m2, [] (long a) {return a >= 50;});
+  check(f.size() == 1 && *f.find(-1) == 100, "lazy aug_filter");
+  lmap m3 = lmap::remove(m2, 5);
+  check(m3.aug_val() == sum + 95, "lazy after remove");
+}
+
+void test_sparse_aug() {
+  using smap = sparse_aug_map<entry_counted, avl_tree, pool_allocator, 16>;
+  size_t n = 10000;
+  pbbs::sequence<pair<int,int>> a(n, [&] (size_t i) {
+      return make_pair((int) i, (int) i % 10);});
+  long sum = 45 * (n/10);
+  smap m(a);
+  check(m.aug_val() == sum, "sparse aug_val");
+  check(m.aug_range(10, 19) == 45 && m.aug_left(9) == 45 &&
+	m.aug_right(n-10) == 45, "sparse aug range");
+  smap m2 = smap::insert(m, make_pair(-1, 100));
+  smap f = smap::aug_filter(m2, [] (long a) {return a >= 50;});
+  check(f.size() == 1 && *f.find(-1) == 100, "sparse aug_filter");
+  smap m3 = smap::remove(m2, 5);
+  check(m3.aug_val() == sum + 95 && m2.aug_val() == sum + 100,
+	"sparse after remove");
+}
+
+struct entry_group {
+  using key_t = int;
+  using val_t = int;
+  using aug_t = long;
+  static inline bool comp(key_t a, key_t b) { return a < b;}
+  static aug_t get_empty() { return 0;}
+  static aug_t from_entry(key_t k, val_t v) { return v;}
+  static aug_t combine(aug_t a, aug_t b) { return a + b;}
+  static aug_t inverse(aug_t a) { return -a;}
+};
+
+void test_aug_inverse() {
+  using gmap = aug_map<entry_group>;
+  using pmap = aug_map<entry_counted>;  // same sums, no inverse
+  check(gmap::Tree::invertible && !pmap::Tree::invertible, "inverse detected");
+  size_t n = 1000;
+  pbbs::sequence<pair<int,int>> a(n, [&] (size_t i) {
+      return make_pair((int) (3*i), (int) (i % 7));});
+  gmap g(a);
+  pmap p(a);
+  bool ok = true;
+  for (int i = 0; i < 300; i++) {
+    int l = rand() % (3*n + 10) - 5, r = rand() % (3*n + 10) - 5;
+    ok = ok && (g.aug_range(l, r) == p.aug_range(l, r));
+  }
+  check(ok, "inverse aug_range matches");
+  check(g.aug_range(10, 5) == 0 && g.aug_range(4, 5) == 0, "inverse empty range");
+}
+
+template <class AM>
+void test_aug_batch() {
+  size_t n = 2000, q = 500;
+  pbbs::sequence<pair<int,int>> a(n, [&] (size_t i) {
+      return make_pair((int) (3*i), (int) (i % 7));});
+  AM m(a);
+  pbbs::sequence<int> keys(q, [&] (size_t i) {return rand() % (3*n + 10) - 5;});
+  pbbs::sequence<int> sorted_keys(q, [&] (size_t i) {return (int) (i * 13);});
+  pbbs::sequence<pair<int,int>> ranges(q, [&] (size_t i) {
+      return make_pair(rand() % (3*n + 10) - 5, rand() % (3*n + 10) - 5);});
+  auto lk = AM::aug_left_batch(m, keys);
+  auto ls = AM::aug_left_batch(m, sorted_keys);
+  auto lr = AM::aug_range_batch(m, ranges);
+  bool ok = true;
+  for (size_t i = 0; i < q; i++) {
+    ok = ok && lk[i] == m.aug_left(keys[i]) && ls[i] == m.aug_left(sorted_keys[i]);
+    ok = ok && lr[i] == m.aug_range(ranges[i].first, ranges[i].second);
+  }
+  check(ok, "batched aug_left and aug_range");
+}
+
+void test_iterators() {
+  size_t n = 10000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, i);});
+  map m(a);
+  size_t i = 0;
+  bool ok = true;
+  for (auto& e : m) ok = ok && (e.first == (int) (2*i++));
+  check(ok && i == n, "iterate in order");
+  auto it = m.end();
+  for (i = n; i > 0; i--) ok = ok && ((--it)->first == (int) (2*(i-1)));
+  check(ok && it == m.begin(), "iterate backwards");
+  check(m.seek(7)->first == 8 && m.seek(8)->first == 8 &&
+	m.seek(2*n) == m.end(), "seek");
+  size_t cnt = 0; long sum = 0;
+  for (auto& e : m.range_view(11, 20)) {cnt++; sum += e.second;}
+  check(cnt == 5 && sum == 6+7+8+9+10, "range_view");
+  check(m.range_view(21, 20).empty() && map().begin() == map().end(),
+	"empty ranges");
+#if __cplusplus >= 202002L
+  static_assert(std::ranges::bidirectional_range<map_range<map::Tree>>);
+  static_assert(std::ranges::view<map_range<map::Tree>>);
+#endif
+
+  pbbs::sequence<pair<int,int>> b(n, [&] (size_t i) {
+      return make_pair((int) i, 1);});
+  aug_map<entry_group> am(b);
+  cnt = 0;
+  for (auto& e : am.range_view(100, 199)) cnt += e.second;
+  check(cnt == 100 && am.seek(500)->first == 500, "aug_map iterators");
+}
+
+void test_merge_join() {
+  size_t n = 100000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, 1);});
+  pbbs::sequence<elt> b(n, [&] (size_t i) {return elt(3*i, 2);});
+  pbbs::sequence<elt> c(n/10, [&] (size_t i) {return elt(5*i, 3);});
+  map ma(a), mb(b), mc(c);
+
+  // keys divisible by 6, and then by 30
+  size_t cnt = 0;
+  bool ok = true;
+  merge_join_foreach<map>({&ma, &mb}, [&] (const merge_join<map>& j) {
+      ok = ok && (j.key() % 6 == 0) && j.entry(0).second == 1 &&
+	j.entry(1).second == 2;
+      cnt++;});
+  check(ok && cnt == (2*n + 5) / 6, "merge join two maps");
+  int last = -1;
+  cnt = 0;
+  for (merge_join<map> j({&ma, &mb, &mc}); !j.done(); j.next()) {
+    ok = ok && (j.key() % 30 == 0) && j.key() > last;
+    last = j.key();
+    cnt++;
+  }
+  check(ok && cnt == (5*(n/10) + 29) / 30, "merge join three maps");
+
+  std::atomic<size_t> pcnt{0};
+  merge_join_foreach_par<map>({&ma, &mb, &mc},
+			      [&] (const merge_join<map>& j) {pcnt++;}, 100);
+  check(pcnt == cnt, "parallel merge join");
+  map empty;
+  check(merge_join<map>({&ma, &empty}).done(), "merge join with empty map");
+}
+
+void test_set_ops_k() {
+  size_t n = 100000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, 1);});
+  pbbs::sequence<elt> b(n, [&] (size_t i) {return elt(3*i, 2);});
+  pbbs::sequence<elt> c(n/10, [&] (size_t i) {return elt(5*i, 3);});
+  pbbs::sequence<elt> d(n/2, [&] (size_t i) {return elt(7*i, 4);});
+  map ma(a), mb(b), mc(c), md(d);
+  // not commutative, so the order of the inputs shows
+  auto f = [] (int x, int y) {return x * 10 + y;};
+
+  auto same = [] (const map& x, const map& y) {
+    return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin());
+  };
+
+  // the inputs are shared here, so they are copied and survive
+  map u = map::map_union(map::map_union(map::map_union(ma, mb, f), mc, f), md, f);
+  map uk = map::map_union_k(vector<map>({ma, mb, mc, md}), f);
+  check(same(u, uk), "k-way union");
+  check(uk.find(210).value == 1234, "k-way union combine order");
+  map in = map::map_intersect(map::map_intersect(ma, mb, f), mc, f);
+  map ik = map::map_intersect_k(vector<map>({ma, mb, mc}), f);
+  check(same(in, ik), "k-way intersect");
+  check(ik.size() == (5*(n/10) + 29) / 30, "k-way intersect size");
+  check(map::map_intersect_k(vector<map>({ma, map(), mb})).size() == 0,
+	"k-way intersect with empty map");
+  check(ma.size() == n && mb.size() == n && map::Tree::check_balance(ma.root),
+	"k-way ops keep inputs");
+
+  // unshared inputs are reused in place
+  map uk2 = map::map_union_k(vector<map>({map(a), map(b), map(c), map(d)}), f);
+  check(same(u, uk2), "k-way union in place");
+  map ik2 = map::map_intersect_k(vector<map>({map(a), map(b), map(c)}), f);
+  check(same(in, ik2) && map::Tree::check_balance(ik2.root), "k-way intersect in place");
+}
+
+void test_set_base() {
+  size_t n = 20000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(pbbs::hash64(i) % (2*n), 1);});
+  pbbs::sequence<elt> b(n, [&] (size_t i) {return elt(pbbs::hash64(i+n) % (2*n), 2);});
+  map ma(a), mb(b);
+  auto f = [] (int x, int y) {return x * 10 + y;};
+  auto same = [] (const map& x, const map& y) {
+    return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin());
+  };
+
+  // nodes allocated by a small update of the shared map ma
+  map one(pbbs::sequence<elt>(1, elt(-1, 5)));
+  map gone(pbbs::sequence<elt>(1, a[0]));
+  auto new_nodes = [&] (const map& x) {
+    size_t before = map::GC::num_used_nodes();
+    map r = (&x == &one) ? map::map_union(ma, x) : map::map_difference(ma, x);
+    return map::GC::num_used_nodes() - before;
+  };
+
+  size_t old = utils::set_base_size;
+  utils::set_base_size = 0;
+  map u = map::map_union(ma, mb, f);
+  map in = map::map_intersect(ma, mb, f);
+  map d = map::map_difference(ma, mb);
+  size_t ins = new_nodes(one), del = new_nodes(gone);
+  for (size_t base : {(size_t) 64, n}) {
+    utils::set_base_size = base;
+    map u2 = map::map_union(ma, mb, f);
+    map in2 = map::map_intersect(ma, mb, f);
+    map d2 = map::map_difference(ma, mb);
+    check(same(u, u2) && map::Tree::check_balance(u2.root), "base case union");
+    check(same(in, in2) && map::Tree::check_balance(in2.root),
+	  "base case intersect");
+    check(same(d, d2) && map::Tree::check_balance(d2.root),
+	  "base case difference");
+    // unshared inputs are reused in place
+    map u3 = map::map_union(map(a), map(b), f);
+    check(same(u, u3), "base case union in place");
+    // shared inputs are path copied, not flattened
+    check(new_nodes(one) == ins && new_nodes(gone) == del,
+	  "base case keeps shared subtrees");
+  }
+  utils::set_base_size = old;
+}
+
+void test_append() {
+  size_t n = 10000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(2*i, 1);});
+  map ma(a);
+  map keep = ma;
+  auto add = [] (int x, int y) {return x + y;};
+
+  // past the end
+  pbbs::sequence<elt> b(100, [&] (size_t i) {return elt(2*n + i, 2);});
+  map m1 = map::append_sorted(ma, b);
+  check(m1.size() == n + 100 && *m1.find(2*n + 5) == 2 &&
+	map::Tree::check_balance(m1.root), "append past end");
+
+  // overlapping the last few keys
+  pbbs::sequence<elt> c(100, [&] (size_t i) {return elt(2*n - 20 + i, 3);});
+  map m2 = map::append_sorted(ma, c, add);
+  map m3 = map::multi_insert(ma, c);
+  check(m2.size() == n + 90 && m2.size() == m3.size(), "append near end size");
+  check(*m2.find(2*n - 20) == 4 && *m2.find(2*n - 19) == 3 &&
+	*m2.find(2*n - 22) == 1, "append near end values");
+  check(map::Tree::check_balance(m2.root), "append near end balance");
+
+  // far from the end falls back to multi_insert_sorted
+  map m4 = map::append_sorted(ma, pbbs::sequence<elt>(1, elt(1, 5)));
+  check(m4.size() == n + 1 && *m4.find(1) == 5, "append far from end");
+  check(keep.size() == n && !keep.contains(2*n) && *keep.find(2*n-20) == 1,
+	"append leaves shared map unchanged");
+
+  // a stream of increasing keys through a transient map
+  auto tr = map::to_transient(std::move(ma));
+  for (size_t i = 0; i < 3*n; i++) tr.insert(elt(2*n + i, 7));
+  map m5 = tr.persistent();
+  check(m5.size() == 4*n && *m5.find(5*n - 1) == 7 &&
+	map::Tree::check_balance(m5.root), "transient append stream");
+}
+
+// values mod 2^64 under affine updates v -> a*v + b, summed
+struct entry_affine {
+  using key_t = int;
+  using val_t = unsigned long;
+  using aug_t = unsigned long;
+  using tag_t = pair<unsigned long, unsigned long>;
+  static inline bool comp(key_t a, key_t b) { return a < b;}
+  static aug_t get_empty() { return 0;}
+  static aug_t from_entry(key_t k, val_t v) { return v;}
+  static aug_t combine(aug_t a, aug_t b) { return a + b;}
+  static val_t apply(val_t v, const tag_t& t) { return t.first * v + t.second;}
+  static aug_t apply_aug(aug_t a, const tag_t& t, size_t n) {
+    return t.first * a + t.second * n;}
+  static tag_t compose(const tag_t& o, const tag_t& t) {
+    return tag_t(t.first * o.first, t.first * o.second + t.second);}
+  static size_t hash(pair<key_t,val_t> e) { return pbbs::hash64(e.first);}
+};
+
+template <class Balance>
+void test_tagged() {
+  using tmap = tagged_aug_map<entry_affine, Balance>;
+  using telt = pair<int, unsigned long>;
+  size_t n = 2000;
+  vector<unsigned long> ref(2*n, 0);
+  vector<bool> in(2*n, false);
+  pbbs::sequence<telt> a(n, [&] (size_t i) {return telt(2*i, i);});
+  for (size_t i = 0; i < n; i++) {ref[2*i] = i; in[2*i] = true;}
+  tmap m(a);
+  tmap old = m;
+
+  auto brute_sum = [&] (int l, int r) {
+    unsigned long s = 0;
+    for (int k = max(l, 0); k <= r && k < (int) (2*n); k++) if (in[k]) s += ref[k];
+    return s;};
+  bool ok = true;
+  for (size_t round = 0; round < 300; round++) {
+    size_t h = pbbs::hash64(round);
+    int l = h % (2*n), r = l + (h >> 20) % 200;
+    if (round % 3 == 2) {
+      // insert one key and remove another
+      int ki = (h >> 30) % (2*n), kr = (h >> 40) % (2*n);
+      m = tmap::insert(std::move(m), telt(ki, round));
+      ref[ki] = round; in[ki] = true;
+      m.remove(kr); in[kr] = false;
+    } else {
+      typename tmap::T t((h >> 8) % 3 + 1, (h >> 12) % 100);
+      m = tmap::range_apply(std::move(m), l, r, t);
+      for (int k = l; k <= r && k < (int) (2*n); k++)
+	ref[k] = t.first * ref[k] + t.second;
+    }
+    ok = ok && m.aug_range(l, r) == brute_sum(l, r);
+    ok = ok && m.aug_val() == brute_sum(0, 2*n);
+    int q = (h >> 24) % (2*n);
+    maybe<unsigned long> v = m.find(q);
+    ok = ok && (bool) v == in[q] && (!v || *v == ref[q]);
+  }
+  check(ok, "tagged map queries");
+  auto es = tmap::entries(m);
+  size_t cnt = 0;
+  for (size_t k = 0; k < 2*n; k++) if (in[k]) {
+      ok = ok && es[cnt].first == (int) k && es[cnt].second == ref[k]; cnt++;}
+  check(ok && cnt == m.size() && m.check_balance(), "tagged map entries");
+  check(old.size() == n && *old.find(2*(n-1)) == n-1 &&
+	old.aug_val() == n * (n-1) / 2, "tagged map old version unchanged");
+}
+
+void test_adaptive_grain() {
+  // the cutoff follows the measured cost per node
+  utils::grain_control cheap, costly;
+  check(cheap.cutoff() == utils::node_limit, "grain before samples");
+  cheap.record(100, 100);
+  costly.record(100000, 100);
+  check(cheap.cutoff() > costly.cutoff() &&
+	costly.cutoff() == utils::grain_control::min_cutoff, "grain cutoffs");
+
+  // the adaptive cutoff is opt-in, and a grain of 0 still always forks
+  check(utils::auto_grain != 0 && utils::auto_grain != utils::node_limit,
+	"auto grain is a separate sentinel");
+
+  // the traversals give the same results with any cutoff
+  struct Add {
+    using T = long;
+    static T identity() { return 0;}
+    static T add(T a, T b) { return a + b;}
+  };
+  size_t n = 20000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(i, i % 7);});
+  map ma(a);
+  auto f = [] (elt e) -> long {return e.second;};
+  auto even = [] (elt e) {return e.first % 2 == 0;};
+  bool ok = true;
+  size_t ag = utils::auto_grain;
+  for (int r = 0; r < 4; r++) {
+    long s = map::map_reduce(ma, f, Add());
+    ok = ok && map::map_reduce(ma, f, Add(), ag) == s;
+    ok = ok && map::map_reduce(ma, f, Add(), 0) == s;
+    ok = ok && map::filter(ma, even, ag).size() == map::filter(ma, even).size();
+    ok = ok && (map::map_reduce_range(ma, 100, 15099, f, Add(), ag) ==
+		map::map_reduce_range(ma, 100, 15099, f, Add()));
+    pbbs::sequence<size_t> idx(n, (size_t) 0);
+    map::foreach_index(ma, [&] (elt e, size_t i) {idx[i] = e.first + 1;},
+		       0, ag);
+    for (size_t i = 0; i < n; i++) ok = ok && idx[i] == i + 1;
+    pbbs::sequence<size_t> in(n, (size_t) 0);
+    map::foreach_range(ma, 100, 15099,
+		       [&] (elt e, size_t i) {in[i] = e.first;}, ag);
+    for (size_t i = 0; i < 15000; i++) ok = ok && in[i] == i + 100;
+  }
+  check(ok && ma.size() == n, "adaptive grain traversals");
+}
+
+void test_search() {
+  size_t n = 50000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(i, i % 1000);});
+  map ma(a);
+  auto big = [] (elt e) {return e.second == 999;};
+  auto none = [] (elt e) {return e.second > 1000;};
+  maybe<elt> x = map::find_if(ma, big);
+  check(x && (*x).second == 999, "find_if");
+  check(!map::find_if(ma, none) && !map::any_of(ma, none) &&
+	map::any_of(ma, big) && map::if_exist(ma, big), "any_of");
+  maybe<elt> y = map::first_match(ma, big);
+  check(y && (*y).first == 999, "first_match");
+  int last = n - 3;
+  auto late = [&] (elt e) {return e.first >= last;};
+  check(map::first_match(ma, late) && (*map::first_match(ma, late)).first
+	== last, "first_match last entries");
+  check(!map::first_match(map(), big), "first_match empty");
+  check(ma.size() == n, "search does not consume");
+}
+
+void test_map_inplace() {
+  size_t n = 20000;
+  pbbs::sequence<elt> a(n, [&] (size_t i) {return elt(i, i);});
+  map ma(a);
+  map keep = ma;
+  auto inc = [] (elt e) {return e.second + 1;};
+  auto dbl = [] (elt e) {return elt(e.first, 2 * e.second);};
+  auto odd = [] (elt e) -> maybe<int> {
+    return (e.first % 2) ? maybe<int>(e.first) : maybe<int>();};
+
+  // shared input: copied, the original is unchanged
+  map m1 = map::map(keep, inc);
+  check(m1.size() == n && *m1.find(7) == 8 && *keep.find(7) == 7,
+	"map of shared map");
+
+  // unshared input: rewritten in place
+  map ma2 = map(a);
+  size_t used = map::GC::num_used_nodes();
+  map m2 = map::map_set(std::move(ma2), dbl);
+  check(map::GC::num_used_nodes() == used && m2.size() == n &&
+	*m2.find(7) == 14 && map::Tree::check_balance(m2.root),
+	"map_set in place");
+  map m3 = map::map_filter(std::move(m2), odd);
+  check(m3.size() == n / 2 && *m3.find(7) == 7 && !m3.contains(8) &&
+	map::Tree::check_balance(m3.root), "map_filter in place");
+  check(map::GC::num_used_nodes() == used - n / 2, "map_filter frees nodes");
+
+  // partly shared input
+  map m4 = map::insert(keep, elt(n, 0));
+  map m5 = map::map(std::move(m4), inc);
+  check(*m5.find(n) == 1 && *m5.find(0) == 1 && *keep.find(0) == 0 &&
+	!keep.contains(n), "map of partly shared map");
+}
+
 void test_all() {
   test_map<wb_map>(0);
   test_map<rb_map>(1);
@@ -473,6 +1342,38 @@ void test_all() {
   test_aug();
   test_index();
   test_intervals();
+  test_multi_apply();
+  test_multi_find();
+  test_range_reduce();
+  test_snapshot();
+  test_reclaim();
+  test_allocators();
+  test_numa();
+  test_no_key_copies();
+  test_aug_inplace();
+  test_lazy_aug();
+  test_iterators();
+  test_merge_join();
+  test_set_ops_k();
+  test_set_base();
+  test_append();
+  test_tagged<weight_balanced_tree>();
+  test_tagged<red_black_tree>();
+  test_tagged<avl_tree>();
+  test_tagged<treap<entry_affine>>();
+  test_adaptive_grain();
+  test_search();
+  test_map_inplace();
+  test_sparse_aug();
+  test_aug_inverse();
+  test_aug_batch<aug_map<entry_group>>();
+  test_aug_batch<aug_map<entry_counted>>();
+  test_aug_batch<lazy_aug_map<entry_group>>();
+  test_transient<map>();
+  test_transient<aug_map<entry, red_black_tree>>();
+  test_blocked();
+  test_blocked_encoded<diff_block_encoder>();
+  test_blocked_encoded<packed_block_encoder>();
   check(map::GC::num_used_nodes() == 0, "used nodes at end");
   check(map_max::GC::num_used_nodes() == 0, "used max nodes at end");
   test_map_reserve_finish();
@@ -1,6 +1,5 @@
 double Q6(maps m, const char* start, const char* end, float discount, int quantity) {
   ship_map sm = m.sm;
-  ship_map ship_range = ship_map::range(sm, Date(start), Date(end));
 
   auto sh_f = [&] (ship_map::E& e) -> double {
     auto li_f = [=] (li_map::E& l) -> double {
@@ -14,7 +13,8 @@ double Q6(maps m, const char* start, const char* end, float discount, int quanti
     return li_map::map_reduce(e.second, li_f, Add<double>());
   };
 
-  return ship_map::map_reduce(ship_range, sh_f, Add<double>(), 1);
+  return ship_map::map_reduce_range(sm, Date(start), Date(end),
+				    sh_f, Add<double>(), 1);
 }
 
 double Q6time(maps m, bool verbose) {
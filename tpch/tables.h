@@ -19,7 +19,7 @@ struct li_entry {
   }
 };
 
-using li_map = pam_set<li_entry>;
+using li_map = pam_set<li_entry, weight_balanced_tree, table_allocator>;
 using receipt_map = date_map<li_map>;
 using ship_map = date_map<li_map>;
 using order_map = keyed_map<pair<Orders,li_map>>;
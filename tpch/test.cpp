@@ -465,13 +465,18 @@ void test_all(bool verbose, bool if_query, bool if_update,
 }
 	
 int main(int argc, char** argv) {
-  commandLine P(argc, argv, "./test [-v] [-q] [-u] [-c] [-s size] [-t txns] [-d directory] [-y keep_versions] [-p]");
+  commandLine P(argc, argv, "./test [-v] [-q] [-u] [-c] [-s size] [-t txns] [-d directory] [-y keep_versions] [-p] [-b reclaim_threads]");
   bool verbose = P.getOption("-v");
   bool if_query = P.getOption("-q");
   bool if_update = P.getOption("-u");
   if_persistent = P.getOption("-p");
   keep_versions = P.getOptionIntValue("-y", 1000000);
   if_collect = P.getOption("-c");
+  // free collected versions on background threads
+  static_assert(li_map::GC::reclaimable && customer_map::GC::reclaimable,
+		"table nodes must accept frees from reclamation threads");
+  int reclaim_threads = P.getOptionIntValue("-b", 0);
+  if (reclaim_threads > 0) reclaim::start(reclaim_threads);
   string default_directory = "/ssd1/tpch/S10/";
   int scale = P.getOptionIntValue("-s", 10);
   int num_txns = P.getOptionIntValue("-t", 10000);
@@ -482,7 +487,8 @@ int main(int argc, char** argv) {
 
   test_all(verbose, if_query, if_update,
 	   scale, num_txns, data_directory);
-  
+
+  reclaim::stop();
   memory_stats();
   return 0;
 }
@@ -1,4 +1,10 @@
 const double epsilon = 0.00001;
+
+// Table nodes come from pools that accept frees from any thread, so
+// collected versions can be freed by the reclamation threads (-b).
+template <class T>
+using table_allocator = hugepage_allocator<T>;
+
 template <class Val>
 struct keyed_entry {
   using key_t = dkey_t;
@@ -7,7 +13,8 @@ struct keyed_entry {
 };
 
 template <class Val>
-using keyed_map = pam_map<keyed_entry<Val>>;
+using keyed_map = pam_map<keyed_entry<Val>, weight_balanced_tree,
+			table_allocator>;
 
 using key_pair = pair<dkey_t,dkey_t>;
 
@@ -19,7 +26,8 @@ struct paired_key_entry {
 };
 
 template <class Val>
-using paired_key_map = pam_map<paired_key_entry<Val>>;
+using paired_key_map = pam_map<paired_key_entry<Val>, weight_balanced_tree,
+			table_allocator>;
 
 template <class Val>
 struct date_entry {
@@ -29,7 +37,8 @@ struct date_entry {
 };
 
 template <class Val>
-using date_map = pam_map<date_entry<Val>>;
+using date_map = pam_map<date_entry<Val>, weight_balanced_tree,
+			table_allocator>;
 
 // Takes a nested map a and flattens it into a sequence
 // Each value of the outer map is another map